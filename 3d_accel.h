@@ -55,6 +55,11 @@ THE SOFTWARE.
 
 #define OP_FBHDA_PAGE_MOD     0x1118 /* VXD */
 #define OP_FBHDA_MODE_QUERY   0x1119 /* VXD */
+#define OP_FBHDA_PALETTE_SET_RANGE 0x111A /* VXD, DRV */
+#define OP_FBHDA_SWAP_EX      0x111B /* VXD, DRV */
+#define OP_FBHDA_PRESENT_STATS 0x111C /* VXD, DRV */
+#define OP_FBHDA_WAIT_VBLANK  0x111D /* VXD, DRV */
+#define OP_FBHDA_BATCH        0x111E /* VXD, DRV */
 
 #define OP_SVGA_VALID         0x2000  /* VXD, DRV, ESCAPE_DRV_NT */
 #define OP_SVGA_SETMODE       0x2001  /* DRV */
@@ -110,6 +115,7 @@ THE SOFTWARE.
 #endif
 
 #define FBHDA_OVERLAYS_MAX 16
+#define FBHDA_MODES_MAX 256
 //#define FBHDA_ROW_ALIGN 8
 #define FBHDA_ROW_ALIGN 4
 
@@ -123,6 +129,33 @@ typedef struct FBHDA_overlay
 	DWORD size;
 } FBHDA_overlay_t;
 
+/* mode index entry, sorted by width, height, bpp, refresh */
+typedef struct FBHDA_mode_key
+{
+	WORD width;
+	WORD height;
+	WORD bpp;
+	WORD refresh; /* 0 = default */
+} FBHDA_mode_key_t;
+
+/* FBHDA_batch operations */
+#define FBHDA_BATCH_RECT       1 /* a, b, c, d = left, top, right, bottom */
+#define FBHDA_BATCH_BEGIN      2 /* a = flags */
+#define FBHDA_BATCH_END        3 /* a = flags */
+#define FBHDA_BATCH_MOUSE_MOVE 4 /* a, b = x, y */
+#define FBHDA_BATCH_PALETTE    5 /* a = index, b = rgb */
+
+#define FBHDA_BATCH_MAX 16
+
+typedef struct FBHDA_batch_op
+{
+	DWORD op;
+	DWORD a;
+	DWORD b;
+	DWORD c;
+	DWORD d;
+} FBHDA_batch_op_t;
+
 typedef struct FBHDA
 {
 	         DWORD cb;
@@ -165,8 +198,19 @@ typedef struct FBHDA
 	         DWORD heap_count; /* number of blocks = heap_size_in_bytes / FB_VRAM_HEAP_GRANULARITY */
 	         DWORD heap_length; /* maximum usable block with current framebuffer */
 	         DWORD vram_bar_size; /* PCI region size, may be larger then vram_size */
-	         DWORD res2;
+#ifndef FBHDA_SIXTEEN
+	         void *devcaps; /* SVGA: SVGA_devcap_cache_t, NULL on other adapters */
+#else
+	         DWORD devcaps;
+#endif
 	         DWORD res3;
+	         DWORD dirty_damaged; /* pixels reported as changed by access_begin/rect (wraps around) */
+	         DWORD dirty_blitted; /* pixels really blitted/updated on screen (wraps around) */
+	volatile DWORD swap_queued; /* flips waiting in queue (FBHDA_swap_ex) */
+	         DWORD modes_cnt; /* 0 = no index, validate by VXD call */
+	         FBHDA_mode_key_t modes[FBHDA_MODES_MAX];
+	volatile DWORD end_posted; /* deferred access_end calls, written only by DRV */
+	volatile DWORD end_done;   /* deferred access_end calls executed, written only by VXD */
 } FBHDA_t;
 
 typedef struct FBHDA_mode
@@ -178,6 +222,16 @@ typedef struct FBHDA_mode
 	         DWORD refresh;
 } FBHDA_mode_t;
 
+typedef struct FBHDA_present_stats
+{
+	         DWORD cb;
+	         DWORD present_count;  /* number of presents/flips (wraps around) */
+	         DWORD present_time;   /* system time of last present in ms */
+	         DWORD vblank_count;   /* number of vblanks since driver start, 0 = unknown */
+	         DWORD vblank_time;    /* system time of last vblank in ms */
+	         DWORD refresh_period; /* measured refresh period in us, 0 = unknown */
+} FBHDA_present_stats_t;
+
 #define FB_VRAM_HEAP_GRANULARITY (4*32)
 /* minimum of vram allocation (32px at 32bpp, or 64px at 16bpp) */
 
@@ -216,18 +270,44 @@ void FBHDA_free();
 #define FBHDA_ACCESS_MOUSE_MOVE 2
 #define FBHDA_ACCESS_SURFACE_DIRTY 4
 
-#define FBHDA_SWAP_NOWAIT     1
-#define FBHDA_SWAP_WAIT       2
-#define FBHDA_SWAP_SCHEDULE   4
+#define FBHDA_SWAP_NOWAIT     1 /* queue flip, never block, replace newest queued frame when full */
+#define FBHDA_SWAP_WAIT       2 /* flip now (same as FBHDA_swap) */
+#define FBHDA_SWAP_SCHEDULE   4 /* queue flip, block only when queue is full */
 
 void FBHDA_access_begin(DWORD flags);
 void FBHDA_access_end(DWORD flags);
 void FBHDA_access_rect(DWORD left, DWORD top, DWORD right, DWORD bottom);
 BOOL FBHDA_swap(DWORD offset);
 BOOL FBHDA_swap_ex(DWORD offset, DWORD flags);
+#ifdef VXD32
+/* internal VXD only */
+BOOL FBHDA_swap_ready();
+/* flip from queue, could return before the flip is on screen */
+BOOL FBHDA_swap_queued(DWORD offset);
+void FBHDA_swap_flush(BOOL wait);
+void FBHDA_present_mark();
+void FBHDA_vblank_measure();
+#endif
+BOOL  FBHDA_present_stats(FBHDA_present_stats_t FBPTR stats);
+/* sleep until next vblank, return vblank counter (0 = no retrace) */
+DWORD FBHDA_wait_vblank();
+/* run array of FBHDA_BATCH_* operations in one call */
+BOOL FBHDA_batch(FBHDA_batch_op_t FBPTR ops, DWORD cnt);
+#ifdef VXD32
+/* execute access_end calls posted by DRV */
+void FBHDA_batch_drain();
+#endif
+#ifdef FBHDA_SIXTEEN
+/* access_rect for block closed by FBHDA_access_end_defer */
+void FBHDA_access_rect_defer(DWORD left, DWORD top, DWORD right, DWORD bottom);
+/* access_end executed by VXD on next call or by its timer */
+void FBHDA_access_end_defer();
+#endif
 void FBHDA_clean();
 void  FBHDA_palette_set(unsigned char index, DWORD rgb);
 DWORD FBHDA_palette_get(unsigned char index);
+/* colors are RGBQUADs, screen is refreshed once for whole range */
+void  FBHDA_palette_set_range(DWORD start, DWORD count, DWORD FBPTR colors);
 
 /* return pitch or 0 when failed */
 DWORD FBHDA_overlay_setup(DWORD overlay, DWORD width, DWORD height, DWORD bpp);
@@ -253,6 +333,7 @@ void mouse_hide();
 void mouse_invalidate(); 
 BOOL mouse_blit();
 void mouse_erase();
+void mouse_move_cancel();
 
 #define MOUSE_BUFFER_SIZE 65535
 
@@ -299,10 +380,21 @@ typedef struct SVGA_DB_region
 {
 	DWORD pid;
 	SVGA_region_info_t info;
-	DWORD pad1;
-	DWORD pad2;
+	DWORD last_fence; /* last fence when region was seen in use (LRU) */
+	DWORD flags;      /* SVGA_DB_REGION_* */
 } SVGA_DB_region_t;
 
+/*
+ * Region eviction: if user space sets EVICTABLE, VXD can move region data to
+ * swappable memory when GPU memory is out. User space has to set USED before
+ * submitting commands which touch the region (VXD restores it before submit)
+ * and must read the address from DB (info.address), not from own copy.
+ */
+#define SVGA_DB_REGION_EVICTABLE 1 /* set by user space */
+#define SVGA_DB_REGION_USED      2 /* set by user space, cleared by VXD on LRU sweep */
+#define SVGA_DB_REGION_EVICTED   4 /* set by VXD, info.address is NULL */
+#define SVGA_DB_REGION_PINNED    8 /* set by VXD, MOB is bound to non-surface object, never evicted */
+
 typedef struct SVGA_DB_context
 {
 	DWORD pid;
@@ -337,8 +429,8 @@ typedef struct SVGA_DB
 	DWORD              *surfaces_map;
 	char                mutexname[64];
 	DWORD               stat_regions_usage;
-	DWORD               pad1;
-	DWORD               pad2;
+	DWORD               stat_evictions;
+	DWORD               stat_restores;
 } SVGA_DB_t;
 
 /* internal VXD only */
@@ -387,6 +479,17 @@ void SVGA_region_free(SVGA_region_info_t FBPTR rinfo);
 #define SVGA_QUERY_FIFO 2
 #define SVGA_QUERY_CAPS 3
 
+/* snapshot of device caps, readable directly from user space (hda->devcaps) */
+#define SVGA_DEVCAP_CACHE_MAX 512
+
+typedef struct SVGA_devcap_cache
+{
+	DWORD valid;      /* 0 when caps must be read by SVGA_query */
+	DWORD generation; /* INC by one on every snapshot */
+	DWORD count;      /* number of valid caps */
+	DWORD caps[SVGA_DEVCAP_CACHE_MAX];
+} SVGA_devcap_cache_t;
+
 DWORD SVGA_query(DWORD type, DWORD index);
 void SVGA_query_vector(DWORD type, DWORD index_start, DWORD count, DWORD *out);
 
@@ -418,6 +521,24 @@ void SVGA_flushcache();
 BOOL SVGA_vxdcmd(DWORD cmd, DWORD arg);
 #define SVGA_CMD_INVALIDATE_FB 1
 #define SVGA_CMD_CLEANUP 2
+#define SVGA_CMD_REGION_RESTORE 3
+#define SVGA_CMD_OTABLE_GROW 4 /* arg = (type << 24) | entries */
+#define SVGA_CMD_DIRTY_RECTS 5 /* arg = SVGA_dirty_rects_t*, regions for next SVGA_CB_DIRTY_SURFACE submit of same thread */
+
+#define SVGA_DIRTY_RECTS_MAX 16
+
+typedef struct SVGA_dirty_rects
+{
+	DWORD cb;    /* sizeof(SVGA_dirty_rects_t) */
+	DWORD count; /* count > SVGA_DIRTY_RECTS_MAX means full screen */
+	struct
+	{
+		DWORD left;
+		DWORD top;
+		DWORD right;
+		DWORD bottom;
+	} rects[SVGA_DIRTY_RECTS_MAX];
+} SVGA_dirty_rects_t;
 
 #endif /* SVGA */
 
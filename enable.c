@@ -147,7 +147,8 @@ VOID WINAPI __loadds BeginAccess_VXD( LPPDEVICE lpDevice, WORD wLeft, WORD wTop,
 {
 	if(wFlags & CURSOREXCLUDE)
 	{
-		FBHDA_access_rect(wLeft, wTop, wRight+1, wBottom+1);
+		/* previous deferred end is executed by the same call */
+		FBHDA_access_rect_defer(wLeft, wTop, wRight+1, wBottom+1);
 //		FBHDA_access_begin(dflags);
 	}
 	if(!mouse_vxd)
@@ -164,7 +165,7 @@ VOID WINAPI __loadds EndAccess_VXD( LPPDEVICE lpDevice, WORD wFlags )
 	}
 	if(wFlags & CURSOREXCLUDE)
 	{
-		FBHDA_access_end(0);
+		FBHDA_access_end_defer();
 	}
 }
 
@@ -143,6 +143,39 @@ WORD CalcPitch( WORD x, WORD bpp )
 }
 
 
+#ifdef VESA
+/* Search mode in sorted index published by VXD,
+ * return 1 = found, 0 = not found, -1 = index not available.
+ */
+static int FindModeIndex( WORD wXRes, WORD wYRes, WORD wBpp )
+{
+	int lo, hi;
+
+	if(hda == NULL || hda->cb < sizeof(FBHDA_t) || hda->modes_cnt == 0)
+		return -1;
+
+	lo = 0;
+	hi = (int)hda->modes_cnt;
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		FBHDA_mode_key_t __far *m = &hda->modes[mid];
+
+		if(m->width == wXRes && m->height == wYRes && m->bpp == wBpp)
+			return 1;
+
+		if(m->width < wXRes ||
+			(m->width == wXRes && (m->height < wYRes ||
+			(m->height == wYRes && m->bpp < wBpp))))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+#endif
+
 /* Return non-zero if given mode is supported. */
 static int IsModeOK( WORD wXRes, WORD wYRes, WORD wBpp )
 {
@@ -171,9 +204,18 @@ static int IsModeOK( WORD wXRes, WORD wYRes, WORD wBpp )
 #endif
 
 #ifdef VESA
-		if(!VESA_validmode(wXRes, wYRes, wBpp))
+		switch(FindModeIndex(wXRes, wYRes, wBpp))
 		{
-			return 0;
+			case 0:
+				return 0;
+			case 1:
+				break;
+			default:
+				if(!VESA_validmode(wXRes, wYRes, wBpp))
+				{
+					return 0;
+				}
+				break;
 		}
 #endif
 
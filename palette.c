@@ -33,26 +33,13 @@ THE SOFTWARE.
 
 #include "3d_accel.h"
 
-#pragma code_seg( _INIT )
-
-static void __loadds __far SetColor(unsigned index, DWORD rgb)
-{
-	FBHDA_palette_set(index, rgb);
-}
-
 #pragma code_seg( _TEXT )
 
 /* Load the VGA DAC with values from color table. */
 static void SetRAMDAC( UINT bStart, UINT bCount, RGBQUAD FAR *lpPal )
 {
-	  BYTE    bIndex = bStart;
-
-    while( bCount-- ) {
-    	 DWORD rgb = ((DWORD)lpPal[bIndex].rgbRed << 16) |
-    	     ((DWORD)lpPal[bIndex].rgbGreen << 8) | (DWORD)lpPal[bIndex].rgbBlue;
-    	     
-       SetColor(bIndex++, rgb);
-    }
+    /* RGBQUAD is 0x00RRGGBB DWORD, so whole range goes by one VXD call */
+    FBHDA_palette_set_range( bStart, bCount, (DWORD FAR *)&lpPal[bStart] );
 }
 
 /* Allow calls from the _INIT segment. */
@@ -234,6 +234,38 @@ BOOL FBHDA_swap(DWORD offset)
 	return status == 0 ? FALSE : TRUE;
 }
 
+BOOL FBHDA_swap_ex(DWORD offset, DWORD flags)
+{
+	static DWORD sOffset;
+	static DWORD sFlags;
+	static BOOL status;
+	sOffset = offset;
+	sFlags = flags;
+	status = FALSE;
+	
+	_asm
+	{
+		.386
+		push eax
+		push edx
+		push ecx
+		push ebx
+		
+	  mov edx, OP_FBHDA_SWAP_EX
+	  mov ecx, [sOffset]
+	  mov ebx, [sFlags]
+	  call dword ptr [VXD_VM]
+	  mov [status], cx
+	  
+	  pop ebx
+	  pop ecx
+		pop edx
+		pop eax
+	}
+	
+	return status == 0 ? FALSE : TRUE;
+}
+
 void FBHDA_clean()
 {
 	_asm
@@ -278,6 +310,40 @@ void FBHDA_palette_set(unsigned char index, DWORD rgb)
 	}
 }
 
+void FBHDA_palette_set_range(DWORD start, DWORD count, DWORD FBPTR colors)
+{
+	static DWORD sStart;
+	static DWORD sCount;
+	static DWORD colors_linear;
+	
+	sStart = start;
+	sCount = count;
+	colors_linear = DPMI_GetSegBase(((DWORD)colors) >> 16);
+	colors_linear += ((DWORD)colors) & 0xFFFFUL;
+	
+	_asm
+	{
+		.386
+		push eax
+		push edx
+		push ecx
+		push ebx
+		push esi
+		
+	  mov edx, OP_FBHDA_PALETTE_SET_RANGE
+	  mov ecx, [sStart]
+	  mov ebx, [sCount]
+	  mov esi, [colors_linear]
+	  call dword ptr [VXD_VM]
+	  
+	  pop esi
+	  pop ebx
+	  pop ecx
+		pop edx
+		pop eax
+	}
+}
+
 DWORD FBHDA_palette_get(unsigned char index)
 {
 	static unsigned char sIndex;
@@ -342,6 +408,146 @@ BOOL FBHDA_gamma_get(VOID FBPTR ramp, DWORD buffer_size)
 	return status == 0 ? FALSE : TRUE;
 }
 
+BOOL FBHDA_present_stats(FBHDA_present_stats_t FBPTR stats)
+{
+	static DWORD stats_linear;
+	static unsigned short status;
+	
+	stats_linear = DPMI_GetSegBase(((DWORD)stats) >> 16);
+	stats_linear += ((DWORD)stats) & 0xFFFFUL;
+	
+	_asm
+	{
+		.386
+		push eax
+		push edx
+		push ecx
+		push edi
+		
+		mov edx, OP_FBHDA_PRESENT_STATS
+		mov edi, [stats_linear]
+		call dword ptr [VXD_VM]
+		mov [status],cx
+		
+		pop edi
+		pop ecx
+		pop edx
+		pop eax
+	}
+	
+	return status == 0 ? FALSE : TRUE;
+}
+
+DWORD FBHDA_wait_vblank()
+{
+	static DWORD vblank;
+	
+	_asm
+	{
+		.386
+		push eax
+		push edx
+		push ecx
+		
+		mov edx, OP_FBHDA_WAIT_VBLANK
+		call dword ptr [VXD_VM]
+		mov [vblank],ecx
+		
+		pop ecx
+		pop edx
+		pop eax
+	}
+	
+	return vblank;
+}
+
+BOOL FBHDA_batch(FBHDA_batch_op_t FBPTR ops, DWORD cnt)
+{
+	static DWORD ops_linear;
+	static DWORD sCnt;
+	static unsigned short status;
+	
+	ops_linear = DPMI_GetSegBase(((DWORD)ops) >> 16);
+	ops_linear += ((DWORD)ops) & 0xFFFFUL;
+	sCnt = cnt;
+	
+	_asm
+	{
+		.386
+		push eax
+		push edx
+		push ecx
+		push edi
+		
+		mov edx, OP_FBHDA_BATCH
+		mov ecx, [sCnt]
+		mov edi, [ops_linear]
+		call dword ptr [VXD_VM]
+		mov [status],cx
+		
+		pop edi
+		pop ecx
+		pop edx
+		pop eax
+	}
+	
+	return status == 0 ? FALSE : TRUE;
+}
+
+/* VXD from older build doesn't know batches */
+static BOOL batch_native()
+{
+	FBHDA_t __far *fb = (FBHDA_t __far*)vxd_fbhda16;
+	
+	return (fb != NULL && fb->cb >= sizeof(FBHDA_t)) ? TRUE : FALSE;
+}
+
+void FBHDA_access_rect_defer(DWORD left, DWORD top, DWORD right, DWORD bottom)
+{
+	static FBHDA_batch_op_t op;
+	
+	if(!batch_native())
+	{
+		FBHDA_access_rect(left, top, right, bottom);
+		return;
+	}
+	
+	/* batched rect lets VXD know that end could be deferred */
+	op.op = FBHDA_BATCH_RECT;
+	op.a  = left;
+	op.b  = top;
+	op.c  = right;
+	op.d  = bottom;
+	FBHDA_batch((FBHDA_batch_op_t FBPTR)&op, 1);
+}
+
+void FBHDA_access_end_defer()
+{
+	static volatile DWORD __far *posted;
+	
+	if(!batch_native())
+	{
+		FBHDA_access_end(0);
+		return;
+	}
+	
+	posted = &((FBHDA_t __far*)vxd_fbhda16)->end_posted;
+	
+	/* one instruction, VXD could drain the counter at any time */
+	_asm
+	{
+		.386
+		push es
+		push bx
+		
+		les bx, [posted]
+		inc dword ptr es:[bx]
+		
+		pop bx
+		pop es
+	}
+}
+
 BOOL FBHDA_gamma_set(VOID FBPTR ramp, DWORD buffer_size)
 {
 	static DWORD ramp_linear;
@@ -42,6 +42,7 @@ THE SOFTWARE.
 #define VESA_CMD_DISPLAY_START  0x4F07
 #define VESA_CMD_PALETTE_FORMAT 0x4F08
 #define VESA_CMD_PALETTE_DATA   0x4F09
+#define VESA_CMD_PM_INTERFACE   0x4F0A
 
 /* VBE 3.0 specification, p.25 */
 
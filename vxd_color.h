@@ -9,22 +9,17 @@ static inline void blit32(
 	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
 {
 	const DWORD bottom = blit_y+blit_h;
-	DWORD x, y;
+	DWORD y;
 	for(y = blit_y; y < bottom; y++)
 	{
 		DWORD *src_ptr = ((DWORD*)(((BYTE*)src) + src_pitch*y))+blit_x;
 		DWORD *dst_ptr = ((DWORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;
 
-		for(x = 0; x < blit_w; x++)
-		{
-			*dst_ptr = *src_ptr;
-			src_ptr++;
-			dst_ptr++;
-		}
+		fb_memcpy(dst_ptr, src_ptr, blit_w*sizeof(DWORD));
 	}
 }
 
-static inline void blit16(
+static inline void blit16_c(
 	void *src, DWORD src_pitch,
 	void *dst, DWORD dst_pitch,
 	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
@@ -46,7 +41,7 @@ static inline void blit16(
 	}
 }
 
-static inline void blit8(
+static inline void blit8_c(
 	void *src, DWORD src_pitch,
 	void *dst, DWORD dst_pitch,
 	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
@@ -58,7 +53,19 @@ static inline void blit8(
 		BYTE *src_ptr = (((BYTE*)src) + src_pitch*y)+blit_x;
 		DWORD *dst_ptr = ((DWORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;		
 		
-		for(x = 0; x < blit_w; x++)
+		/* 4 indexes per one read, lookup can't be vectorised without gather */
+		for(x = blit_w >> 2; x > 0; x--)
+		{
+			DWORD idx4 = *((DWORD*)src_ptr);
+			dst_ptr[0] = palette_emulation[idx4 & 0xFF];
+			dst_ptr[1] = palette_emulation[(idx4 >> 8) & 0xFF];
+			dst_ptr[2] = palette_emulation[(idx4 >> 16) & 0xFF];
+			dst_ptr[3] = palette_emulation[idx4 >> 24];
+			src_ptr += 4;
+			dst_ptr += 4;
+		}
+		
+		for(x = blit_w & 3; x > 0; x--)
 		{
 			*dst_ptr = palette_emulation[*src_ptr];
 			src_ptr++;
@@ -67,7 +74,117 @@ static inline void blit8(
 	}
 }
 
-static inline void readback16(
+/*
+ * Double pixel palette table: one WORD of two indexes gives two RGB DWORDs
+ * (256*256*8 = 512 kB). When palette generation (hda->palette_update)
+ * changed, only the rows and columns of changed entries are rewritten
+ * (512 DWORDs per entry), so palette animation costs at most one rebuild.
+ */
+#define PALETTE_LUT16_MIN_PIXELS (64*1024)
+
+static DWORD *palette_lut16 = NULL;
+static DWORD palette_lut16_gen = 0;
+static BOOL palette_lut16_valid = FALSE;
+static DWORD palette_lut16_pal[256]; /* palette which the table is built from */
+
+static BOOL palette_lut16_update(DWORD pal_gen)
+{
+	DWORD hi, lo;
+	DWORD *ptr;
+
+	if(palette_lut16 == NULL)
+	{
+		palette_lut16 = (DWORD*)_PageAllocate(RoundToPages(256*256*2*sizeof(DWORD)), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
+		if(palette_lut16 == NULL)
+		{
+			return FALSE;
+		}
+	}
+
+	if(palette_lut16_valid && palette_lut16_gen == pal_gen)
+	{
+		return TRUE;
+	}
+
+	if(!palette_lut16_valid)
+	{
+		ptr = palette_lut16;
+		for(hi = 0; hi < 256; hi++)
+		{
+			DWORD px_hi = palette_emulation[hi];
+			for(lo = 0; lo < 256; lo++)
+			{
+				ptr[0] = palette_emulation[lo];
+				ptr[1] = px_hi;
+				ptr += 2;
+			}
+			palette_lut16_pal[hi] = px_hi;
+		}
+	}
+	else
+	{
+		DWORD c;
+		for(c = 0; c < 256; c++)
+		{
+			DWORD px = palette_emulation[c];
+			if(px == palette_lut16_pal[c])
+				continue;
+
+			/* low pixel of every pair with this index */
+			ptr = palette_lut16 + (c << 1);
+			for(hi = 0; hi < 256; hi++)
+			{
+				*ptr = px;
+				ptr += 512;
+			}
+
+			/* high pixel of every pair with this index */
+			ptr = palette_lut16 + (c << 9) + 1;
+			for(lo = 0; lo < 256; lo++)
+			{
+				*ptr = px;
+				ptr += 2;
+			}
+
+			palette_lut16_pal[c] = px;
+		}
+	}
+
+	palette_lut16_gen = pal_gen;
+	palette_lut16_valid = TRUE;
+
+	return TRUE;
+}
+
+static inline void blit8_lut16(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+	const DWORD bottom = blit_y+blit_h;
+	DWORD x, y;
+	for(y = blit_y; y < bottom; y++)
+	{
+		WORD *src_ptr = (WORD*)((((BYTE*)src) + src_pitch*y)+blit_x);
+		DWORD *dst_ptr = ((DWORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;
+
+		for(x = blit_w >> 1; x > 0; x--)
+		{
+			DWORD *px2 = palette_lut16 + (((DWORD)*src_ptr) << 1);
+			dst_ptr[0] = px2[0];
+			dst_ptr[1] = px2[1];
+			src_ptr++;
+			dst_ptr += 2;
+		}
+
+		if(blit_w & 1)
+		{
+			*dst_ptr = palette_emulation[*((BYTE*)src_ptr)];
+		}
+	}
+}
+
+static inline void readback16_c(
 	void *src, DWORD src_pitch,
 	void *dst, DWORD dst_pitch,
 	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
@@ -89,4 +206,532 @@ static inline void readback16(
 	}
 }
 
+/*
+ * MMX and SSE2 variants of 16bpp conversions, selected by color_init().
+ * FPU/SSE state of interrupted thread is saved around every call, so
+ * SIMD is used only for larger rectangles.
+ */
+#define COLOR_SIMD_NONE CPU_SIMD_NONE
+#define COLOR_SIMD_MMX  CPU_SIMD_MMX
+#define COLOR_SIMD_SSE2 CPU_SIMD_SSE2
+
+#define COLOR_SIMD_MIN_PIXELS 1024
+
+static DWORD color_simd = COLOR_SIMD_NONE;
+
+#ifndef I486
+
+static const DWORD color_mask_565r[4] = {0x0000F800, 0x0000F800, 0x0000F800, 0x0000F800};
+static const DWORD color_mask_565g[4] = {0x000007E0, 0x000007E0, 0x000007E0, 0x000007E0};
+static const DWORD color_mask_565b[4] = {0x0000001F, 0x0000001F, 0x0000001F, 0x0000001F};
+
+static const DWORD color_mask_888r[4] = {0x00F80000, 0x00F80000, 0x00F80000, 0x00F80000};
+static const DWORD color_mask_888g[4] = {0x0000FC00, 0x0000FC00, 0x0000FC00, 0x0000FC00};
+static const DWORD color_mask_888b[4] = {0x000000F8, 0x000000F8, 0x000000F8, 0x000000F8};
+
+/* FSAVE/FXSAVE area, blits are serialized by hda_sem */
+static BYTE color_fpu_state[512+16];
+static DWORD color_fpu_ts = 0;
+
+/*
+ * VMM switches FPU lazily, so CR0.TS could be set and any FPU instruction
+ * would raise #NM in ring 0. Clear TS for the time of SIMD block and set it
+ * back after the state of the current FPU owner is restored.
+ */
+static BYTE *color_fpu_save(BOOL sse2)
+{
+	BYTE *fpu = (BYTE*)(((DWORD)color_fpu_state + 15) & ~15UL);
+	DWORD ts;
+	
+	_asm
+	{
+		.586p
+		push eax
+		mov eax, cr0
+		and eax, 8
+		mov [ts], eax
+		clts
+		pop eax
+	}
+	color_fpu_ts = ts;
+	
+	if(sse2)
+	{
+		_asm
+		{
+			.686
+			.xmm2
+			push eax
+			mov eax, [fpu]
+			fxsave [eax]
+			pop eax
+		}
+	}
+	else
+	{
+		_asm
+		{
+			.586
+			push eax
+			mov eax, [fpu]
+			fsave [eax]
+			pop eax
+		}
+	}
+	
+	return fpu;
+}
+
+static void color_fpu_restore(BYTE *fpu, BOOL sse2)
+{
+	if(sse2)
+	{
+		_asm
+		{
+			.686
+			.xmm2
+			push eax
+			mov eax, [fpu]
+			fxrstor [eax]
+			pop eax
+		}
+	}
+	else
+	{
+		_asm
+		{
+			.586
+			.mmx
+			emms
+			push eax
+			mov eax, [fpu]
+			frstor [eax]
+			pop eax
+		}
+	}
+	
+	if(color_fpu_ts)
+	{
+		_asm
+		{
+			.586p
+			push eax
+			mov eax, cr0
+			or eax, 8
+			mov cr0, eax
+			pop eax
+		}
+	}
+}
+
+static void color_init()
+{
+	color_simd = cpu_simd();
+	dbg_printf("color_init: SIMD: %ld\n", color_simd);
+}
+
+static void blit16_simd(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+	const DWORD bottom = blit_y+blit_h;
+	const BOOL sse2 = (color_simd == COLOR_SIMD_SSE2);
+	const DWORD step = sse2 ? 8 : 4;
+	BYTE *fpu = color_fpu_save(sse2);
+	DWORD x, y;
+	
+	for(y = blit_y; y < bottom; y++)
+	{
+		WORD *src_ptr = ((WORD*)(((BYTE*)src) + src_pitch*y))+blit_x;
+		DWORD *dst_ptr = ((DWORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;
+		DWORD cnt = blit_w / step;
+		
+		if(sse2)
+		{
+			_asm
+			{
+				.686
+				.xmm2
+				push ecx
+				push esi
+				push edi
+				mov esi, [src_ptr]
+				mov edi, [dst_ptr]
+				mov ecx, [cnt]
+				movdqu xmm5, [color_mask_565r]
+				movdqu xmm6, [color_mask_565g]
+				movdqu xmm7, [color_mask_565b]
+				pxor xmm4, xmm4
+			blit16_sse2_loop:
+				movdqu xmm0, [esi]
+				movdqa xmm1, xmm0
+				punpcklwd xmm0, xmm4
+				punpckhwd xmm1, xmm4
+				
+				movdqa xmm2, xmm0
+				movdqa xmm3, xmm0
+				pand xmm0, xmm5
+				pslld xmm0, 8
+				pand xmm2, xmm6
+				pslld xmm2, 5
+				pand xmm3, xmm7
+				pslld xmm3, 3
+				por xmm0, xmm2
+				por xmm0, xmm3
+				movdqu [edi], xmm0
+				
+				movdqa xmm2, xmm1
+				movdqa xmm3, xmm1
+				pand xmm1, xmm5
+				pslld xmm1, 8
+				pand xmm2, xmm6
+				pslld xmm2, 5
+				pand xmm3, xmm7
+				pslld xmm3, 3
+				por xmm1, xmm2
+				por xmm1, xmm3
+				movdqu [edi+16], xmm1
+				
+				add esi, 16
+				add edi, 32
+				dec ecx
+				jnz blit16_sse2_loop
+				pop edi
+				pop esi
+				pop ecx
+			}
+		}
+		else
+		{
+			_asm
+			{
+				.586
+				.mmx
+				push ecx
+				push esi
+				push edi
+				mov esi, [src_ptr]
+				mov edi, [dst_ptr]
+				mov ecx, [cnt]
+				movq mm5, [color_mask_565r]
+				movq mm6, [color_mask_565g]
+				movq mm7, [color_mask_565b]
+				pxor mm4, mm4
+			blit16_mmx_loop:
+				movq mm0, [esi]
+				movq mm1, mm0
+				punpcklwd mm0, mm4
+				punpckhwd mm1, mm4
+				
+				movq mm2, mm0
+				movq mm3, mm0
+				pand mm0, mm5
+				pslld mm0, 8
+				pand mm2, mm6
+				pslld mm2, 5
+				pand mm3, mm7
+				pslld mm3, 3
+				por mm0, mm2
+				por mm0, mm3
+				movq [edi], mm0
+				
+				movq mm2, mm1
+				movq mm3, mm1
+				pand mm1, mm5
+				pslld mm1, 8
+				pand mm2, mm6
+				pslld mm2, 5
+				pand mm3, mm7
+				pslld mm3, 3
+				por mm1, mm2
+				por mm1, mm3
+				movq [edi+8], mm1
+				
+				add esi, 8
+				add edi, 16
+				dec ecx
+				jnz blit16_mmx_loop
+				pop edi
+				pop esi
+				pop ecx
+			}
+		}
+		
+		src_ptr += cnt*step;
+		dst_ptr += cnt*step;
+		
+		for(x = blit_w % step; x > 0; x--)
+		{
+			DWORD px = *src_ptr;
+			*dst_ptr = ((px & 0xF800) << 8) | ((px & 0x07E0) << 5) | ((px & 0x001F) << 3);
+			src_ptr++;
+			dst_ptr++;
+		}
+	}
+	
+	color_fpu_restore(fpu, sse2);
+}
+
+static void readback16_simd(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+	const DWORD bottom = blit_y+blit_h;
+	const BOOL sse2 = (color_simd == COLOR_SIMD_SSE2);
+	const DWORD step = sse2 ? 8 : 4;
+	BYTE *fpu = color_fpu_save(sse2);
+	DWORD x, y;
+	
+	for(y = blit_y; y < bottom; y++)
+	{
+		DWORD *src_ptr = ((DWORD*)(((BYTE*)src) + src_pitch*y))+blit_x;
+		WORD  *dst_ptr =  ((WORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;
+		DWORD cnt = blit_w / step;
+		
+		/* result is sign extended from 16 bits so packssdw don't saturate */
+		if(sse2)
+		{
+			_asm
+			{
+				.686
+				.xmm2
+				push ecx
+				push esi
+				push edi
+				mov esi, [src_ptr]
+				mov edi, [dst_ptr]
+				mov ecx, [cnt]
+				movdqu xmm5, [color_mask_888r]
+				movdqu xmm6, [color_mask_888g]
+				movdqu xmm7, [color_mask_888b]
+			readback16_sse2_loop:
+				movdqu xmm0, [esi]
+				movdqu xmm1, [esi+16]
+				
+				movdqa xmm2, xmm0
+				movdqa xmm3, xmm0
+				pand xmm0, xmm5
+				psrld xmm0, 8
+				pand xmm2, xmm6
+				psrld xmm2, 5
+				pand xmm3, xmm7
+				psrld xmm3, 3
+				por xmm0, xmm2
+				por xmm0, xmm3
+				pslld xmm0, 16
+				psrad xmm0, 16
+				
+				movdqa xmm2, xmm1
+				movdqa xmm3, xmm1
+				pand xmm1, xmm5
+				psrld xmm1, 8
+				pand xmm2, xmm6
+				psrld xmm2, 5
+				pand xmm3, xmm7
+				psrld xmm3, 3
+				por xmm1, xmm2
+				por xmm1, xmm3
+				pslld xmm1, 16
+				psrad xmm1, 16
+				
+				packssdw xmm0, xmm1
+				movdqu [edi], xmm0
+				
+				add esi, 32
+				add edi, 16
+				dec ecx
+				jnz readback16_sse2_loop
+				pop edi
+				pop esi
+				pop ecx
+			}
+		}
+		else
+		{
+			_asm
+			{
+				.586
+				.mmx
+				push ecx
+				push esi
+				push edi
+				mov esi, [src_ptr]
+				mov edi, [dst_ptr]
+				mov ecx, [cnt]
+				movq mm5, [color_mask_888r]
+				movq mm6, [color_mask_888g]
+				movq mm7, [color_mask_888b]
+			readback16_mmx_loop:
+				movq mm0, [esi]
+				movq mm1, [esi+8]
+				
+				movq mm2, mm0
+				movq mm3, mm0
+				pand mm0, mm5
+				psrld mm0, 8
+				pand mm2, mm6
+				psrld mm2, 5
+				pand mm3, mm7
+				psrld mm3, 3
+				por mm0, mm2
+				por mm0, mm3
+				pslld mm0, 16
+				psrad mm0, 16
+				
+				movq mm2, mm1
+				movq mm3, mm1
+				pand mm1, mm5
+				psrld mm1, 8
+				pand mm2, mm6
+				psrld mm2, 5
+				pand mm3, mm7
+				psrld mm3, 3
+				por mm1, mm2
+				por mm1, mm3
+				pslld mm1, 16
+				psrad mm1, 16
+				
+				packssdw mm0, mm1
+				movq [edi], mm0
+				
+				add esi, 16
+				add edi, 8
+				dec ecx
+				jnz readback16_mmx_loop
+				pop edi
+				pop esi
+				pop ecx
+			}
+		}
+		
+		src_ptr += cnt*step;
+		dst_ptr += cnt*step;
+		
+		for(x = blit_w % step; x > 0; x--)
+		{
+			DWORD px = *src_ptr;
+			*dst_ptr = ((px & 0xF80000) >> 8) | ((px & 0xFC00) >> 5) | ((px & 0x00F8) >> 3);
+			src_ptr++;
+			dst_ptr++;
+		}
+	}
+	
+	color_fpu_restore(fpu, sse2);
+}
+
+static void blit8_lut16_mmx(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+	const DWORD bottom = blit_y+blit_h;
+	const DWORD cnt = blit_w >> 1;
+	DWORD *lut = palette_lut16;
+	BYTE *fpu = color_fpu_save(FALSE);
+	DWORD y;
+
+	for(y = blit_y; y < bottom; y++)
+	{
+		BYTE *src_ptr = (((BYTE*)src) + src_pitch*y)+blit_x;
+		DWORD *dst_ptr = ((DWORD*)(((BYTE*)dst) + dst_pitch*y))+blit_x;
+
+		/* no gather needed, every WORD is one 64-bit load from table */
+		_asm
+		{
+			.586
+			.mmx
+			push eax
+			push ecx
+			push esi
+			push edi
+			push ebx
+			mov esi, [src_ptr]
+			mov edi, [dst_ptr]
+			mov ecx, [cnt]
+			mov ebx, [lut]
+		blit8_mmx_loop:
+			movzx eax, word ptr [esi]
+			movq mm0, [ebx+eax*8]
+			movq [edi], mm0
+			add esi, 2
+			add edi, 8
+			dec ecx
+			jnz blit8_mmx_loop
+			pop ebx
+			pop edi
+			pop esi
+			pop ecx
+			pop eax
+		}
+
+		if(blit_w & 1)
+		{
+			dst_ptr[blit_w-1] = palette_emulation[src_ptr[blit_w-1]];
+		}
+	}
+
+	color_fpu_restore(fpu, FALSE);
+}
+
+#else /* I486 */
+
+static void color_init()
+{
+	color_simd = COLOR_SIMD_NONE;
+}
+
+#endif /* I486 */
+
+static inline void blit16(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+#ifndef I486
+	if(color_simd != COLOR_SIMD_NONE && blit_w >= 8 && blit_w*blit_h >= COLOR_SIMD_MIN_PIXELS)
+	{
+		blit16_simd(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+		return;
+	}
+#endif
+	blit16_c(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+}
+
+static inline void blit8(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h, DWORD pal_gen)
+{
+	if(blit_w >= 2 && blit_w*blit_h >= PALETTE_LUT16_MIN_PIXELS && palette_lut16_update(pal_gen))
+	{
+#ifndef I486
+		if(color_simd != COLOR_SIMD_NONE)
+		{
+			blit8_lut16_mmx(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+			return;
+		}
+#endif
+		blit8_lut16(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+		return;
+	}
+	blit8_c(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+}
+
+static inline void readback16(
+	void *src, DWORD src_pitch,
+	void *dst, DWORD dst_pitch,
+	DWORD blit_x, DWORD blit_y, DWORD blit_w, DWORD blit_h)
+{
+#ifndef I486
+	if(color_simd != COLOR_SIMD_NONE && blit_w >= 8 && blit_w*blit_h >= COLOR_SIMD_MIN_PIXELS)
+	{
+		readback16_simd(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+		return;
+	}
+#endif
+	readback16_c(src, src_pitch, dst, dst_pitch, blit_x, blit_y, blit_w, blit_h);
+}
+
 #endif /* __VXD_COLOR_H__INCLUDED__ */
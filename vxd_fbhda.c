@@ -29,9 +29,15 @@ THE SOFTWARE.
 #include "vxd_lib.h"
 #include "3d_accel.h"
 
+#include "boxvint.h" /* VGA registers */
+
 #include "code32.h"
 
+#define IO_IN8
+#include "io32.h"
+
 #include "vxd_gamma.h"
+#include "mtrr.h"
 
 FBHDA_t *hda = NULL;
 ULONG hda_sem = 0;
@@ -144,10 +150,460 @@ FBHDA_t *FBHDA_setup()
 	return hda;
 }
 
+/*
+ * Flip queue for FBHDA_SWAP_SCHEDULE/FBHDA_SWAP_NOWAIT: swap only stores the
+ * offset and returns, the real FBHDA_swap is done when adapter is ready
+ * (previous screen update is finished or in vblank). Queue is checked on
+ * every swap, on every access end and by timer while it isn't empty. When
+ * adapter isn't ready for SWAP_IDLE_TICKS, queued frame is presented anyway.
+ */
+#define SWAP_QUEUE_MAX 2
+#define SWAP_INTERVAL 2 /* ms */
+#define SWAP_IDLE_TICKS 4
+
+static DWORD swap_queue[SWAP_QUEUE_MAX];
+static DWORD swap_queue_cnt = 0;
+static BOOL swap_flushing = FALSE;
+static DWORD swap_idle_ticks = 0;
+
+static void swap_event_proc();
+static sys_event_t swap_event = {0, 0, swap_event_proc};
+
+/* system VM event, FBHDA_swap could wait on hda_sem */
+static void swap_event_proc()
+{
+	if(swap_queue_cnt == 0)
+		return;
+
+	/* DRV drawing done meanwhile could hold the lock */
+	FBHDA_batch_drain();
+	FBHDA_swap_flush(FALSE);
+
+	if(swap_queue_cnt > 0)
+	{
+		if(++swap_idle_ticks >= SWAP_IDLE_TICKS)
+		{
+			/* no retrace seen for long time, present the frame */
+			FBHDA_swap_flush(TRUE);
+		}
+		sys_event_arm(&swap_event, SWAP_INTERVAL);
+	}
+}
+
+/* wait = TRUE: apply at least one queued flip even when adapter isn't ready */
+void FBHDA_swap_flush(BOOL wait)
+{
+	DWORD i;
+	DWORD offset;
+
+	Begin_Critical_Section(0);
+	if(swap_flushing)
+	{
+		End_Critical_Section();
+		return;
+	}
+	swap_flushing = TRUE;
+	End_Critical_Section();
+
+	while(swap_queue_cnt > 0)
+	{
+		if(!wait && !FBHDA_swap_ready())
+		{
+			break;
+		}
+
+		Begin_Critical_Section(0);
+		offset = swap_queue[0];
+		for(i = 1; i < swap_queue_cnt; i++)
+		{
+			swap_queue[i-1] = swap_queue[i];
+		}
+		swap_queue_cnt--;
+		hda->swap_queued = swap_queue_cnt;
+		End_Critical_Section();
+
+		/* mode could be changed meanwhile */
+		if(offset >= hda->system_surface && offset + hda->stride <= hda->vram_size)
+		{
+			FBHDA_swap_queued(offset);
+		}
+		swap_idle_ticks = 0;
+		wait = FALSE;
+	}
+
+	swap_flushing = FALSE;
+}
+
+BOOL FBHDA_swap_ex(DWORD offset, DWORD flags)
+{
+	if((flags & (FBHDA_SWAP_SCHEDULE | FBHDA_SWAP_NOWAIT)) == 0)
+	{
+		/* synchronous swap, queued frames are older, drop them */
+		Begin_Critical_Section(0);
+		swap_queue_cnt = 0;
+		hda->swap_queued = 0;
+		End_Critical_Section();
+
+		return FBHDA_swap(offset);
+	}
+
+	if(offset < hda->system_surface || offset + hda->stride > hda->vram_size)
+	{
+		return FALSE;
+	}
+
+	FBHDA_swap_flush(FALSE);
+
+	if(swap_queue_cnt >= SWAP_QUEUE_MAX && (flags & FBHDA_SWAP_NOWAIT) == 0)
+	{
+		/* could do nothing when other flush is running */
+		FBHDA_swap_flush(TRUE);
+	}
+
+	Begin_Critical_Section(0);
+	if(swap_queue_cnt < SWAP_QUEUE_MAX)
+	{
+		swap_queue[swap_queue_cnt++] = offset;
+		hda->swap_queued = swap_queue_cnt;
+	}
+	else
+	{
+		/* still full, replace newest frame which wasn't displayed yet */
+		swap_queue[SWAP_QUEUE_MAX-1] = offset;
+	}
+	End_Critical_Section();
+
+	/* adapter may be ready right now */
+	FBHDA_swap_flush(FALSE);
+
+	/* otherwise present it on next retrace without waiting for next swap */
+	if(swap_queue_cnt > 0)
+	{
+		sys_event_arm(&swap_event, SWAP_INTERVAL);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Present statistics. We don't have vblank interrupt in VM, so vblanks are
+ * virtual grid of refresh_period intervals over VMM system time (ms). Period
+ * is measured from VGA retrace bit after mode set and grid is re-aligned to
+ * real retrace by every FBHDA_wait_vblank. Without retrace bit (non-VGA
+ * adapter or retrace isn't emulated) or with implausible period no vblank
+ * counter is reported (refresh_period = 0).
+ * Grid position is kept as ms + us remainder to stay in 32-bit arithmetic.
+ */
+#define VBLANK_REBASE_MS 4000000 /* delta*1000 must fit to DWORD */
+#define VBLANK_MEASURE_FRAMES 8
+#define VBLANK_TIMEOUT_MS 60 /* longer than VBLANK_PERIOD_MAX */
+#define VBLANK_SPIN_MS 2 /* poll retrace bit only this time before vblank */
+#define VBLANK_PERIOD_MIN 5000  /* us, 200 Hz */
+#define VBLANK_PERIOD_MAX 50000 /* us, 20 Hz */
+
+static DWORD present_count = 0;
+static DWORD present_time = 0;
+static DWORD vblank_count = 0;
+static DWORD vblank_time = 0;
+static DWORD vblank_time_us = 0;
+static BOOL vblank_hw = FALSE;
+static DWORD refresh_period = 0;
+
+/* wait for start of vertical retrace, FALSE when it doesn't come in time */
+static BOOL retrace_wait_start(DWORD timeout_ms)
+{
+	DWORD start = Get_System_Time();
+
+	while(inp(VGA_STAT_ADDR) & VGA_STAT_VSYNC)
+	{
+		if(Get_System_Time() - start > timeout_ms)
+			return FALSE;
+	}
+
+	while((inp(VGA_STAT_ADDR) & VGA_STAT_VSYNC) == 0)
+	{
+		if(Get_System_Time() - start > timeout_ms)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Measure refresh period over few frames. Called by driver after mode set,
+ * it spins for ~10 frames, so never call it from present path.
+ */
+void FBHDA_vblank_measure()
+{
+	DWORD t0, t1;
+	DWORD period;
+	DWORD i;
+
+	vblank_hw = FALSE;
+
+	if(!retrace_wait_start(VBLANK_TIMEOUT_MS))
+	{
+		dbg_printf("vblank: no retrace\n");
+		return;
+	}
+
+	t0 = Get_System_Time();
+	for(i = 0; i < VBLANK_MEASURE_FRAMES; i++)
+	{
+		if(!retrace_wait_start(VBLANK_TIMEOUT_MS))
+			return;
+	}
+	t1 = Get_System_Time();
+
+	period = ((t1 - t0) * 1000) / VBLANK_MEASURE_FRAMES;
+
+	/* some emulators toggle the bit on every read */
+	if(period < VBLANK_PERIOD_MIN || period > VBLANK_PERIOD_MAX)
+	{
+		dbg_printf("vblank: bogus period %ld us\n", period);
+		return;
+	}
+
+	Begin_Critical_Section(0);
+	refresh_period = period;
+	vblank_time = t1;
+	vblank_time_us = 0;
+	vblank_hw = TRUE;
+	End_Critical_Section();
+
+	dbg_printf("vblank: period %ld us\n", period);
+}
+
+static void vblank_update()
+{
+	DWORD now;
+	DWORD delta, elapsed, n, adv;
+
+	if(!vblank_hw)
+		return;
+
+	now = Get_System_Time();
+
+	Begin_Critical_Section(0);
+	delta = now - vblank_time;
+	if(delta >= VBLANK_REBASE_MS)
+	{
+		/* long time without any call, precision doesn't matter */
+		vblank_count += delta / (refresh_period / 1000);
+		vblank_time = now;
+		vblank_time_us = 0;
+		End_Critical_Section();
+		return;
+	}
+
+	elapsed = delta * 1000;
+	if(elapsed > vblank_time_us)
+	{
+		elapsed -= vblank_time_us;
+		n = elapsed / refresh_period;
+		if(n > 0)
+		{
+			vblank_count += n;
+			adv = n * refresh_period + vblank_time_us;
+			vblank_time += adv / 1000;
+			vblank_time_us = adv % 1000;
+		}
+	}
+	End_Critical_Section();
+}
+
+void FBHDA_present_mark()
+{
+	DWORD now = Get_System_Time();
+
+	Begin_Critical_Section(0);
+	present_count++;
+	present_time = now;
+	End_Critical_Section();
+}
+
+BOOL FBHDA_present_stats(FBHDA_present_stats_t *stats)
+{
+	if(stats == NULL || stats->cb < sizeof(FBHDA_present_stats_t))
+	{
+		return FALSE;
+	}
+
+	vblank_update();
+
+	Begin_Critical_Section(0);
+	stats->present_count  = present_count;
+	stats->present_time   = present_time;
+	stats->vblank_count   = vblank_hw ? vblank_count : 0;
+	stats->vblank_time    = vblank_hw ? vblank_time : 0;
+	stats->refresh_period = vblank_hw ? refresh_period : 0;
+	End_Critical_Section();
+
+	return TRUE;
+}
+
+DWORD FBHDA_wait_vblank()
+{
+	DWORD start;
+
+	vblank_update();
+	if(!vblank_hw)
+	{
+		/* nothing to wait for, at least don't spin the caller */
+		Release_Time_Slice();
+		return 0;
+	}
+
+	start = vblank_count;
+
+	/* sleep until predicted vblank is close, VMM time has 1 ms resolution */
+	while(vblank_count == start &&
+		(Get_System_Time() - vblank_time) * 1000 + VBLANK_SPIN_MS*1000 < refresh_period)
+	{
+		Release_Time_Slice();
+		vblank_update();
+	}
+
+	if(vblank_count != start)
+	{
+		/* already passed by the grid */
+		return vblank_count;
+	}
+
+	/* catch the real retrace and align the grid to it, spin is limited to the window */
+	if(retrace_wait_start(VBLANK_SPIN_MS*2))
+	{
+		Begin_Critical_Section(0);
+		vblank_time = Get_System_Time();
+		vblank_time_us = 0;
+		if(vblank_count == start)
+		{
+			vblank_count++;
+		}
+		End_Critical_Section();
+	}
+	else
+	{
+		/* missed it, leave it to the grid */
+		while(vblank_count == start)
+		{
+			Release_Time_Slice();
+			vblank_update();
+		}
+	}
+
+	return vblank_count;
+}
+
+/*
+ * Deferred access_end of DRV (FBHDA_access_end_defer): DRV only increments
+ * end_posted, VXD executes the ends on the start of next PM16/IOCTL call,
+ * from mouse and flip events, or from its own system VM event BATCH_INTERVAL
+ * after DRV becomes idle, so the screen update isn't held for a frame.
+ *
+ * Locking: end_done and batch_locks are updated in critical section before
+ * FBHDA_access_end is called, so every posted end is executed exactly once
+ * even when access_end blocks on hda_sem and another drain runs meanwhile.
+ * hda_sem is held only inside of FBHDA_* calls, so drain must be called only
+ * from entry points (API procs, event), never from code holding hda_sem.
+ */
+#define BATCH_INTERVAL 2 /* ms, deferred end has to land in the same frame */
+
+static DWORD batch_locks = 0; /* locks taken by batch which wait for deferred end */
+
+static void batch_event_proc();
+static sys_event_t batch_event = {0, 0, batch_event_proc};
+
+/* system VM event, could wait on hda_sem */
+static void batch_event_proc()
+{
+	FBHDA_batch_drain();
+
+	/* DRV is still drawing, check it later */
+	if(batch_locks > 0)
+	{
+		sys_event_arm(&batch_event, BATCH_INTERVAL);
+	}
+}
+
+void FBHDA_batch_drain()
+{
+	if(hda == NULL)
+		return;
+
+	for(;;)
+	{
+		Begin_Critical_Section(0);
+		if(hda->end_done == hda->end_posted)
+		{
+			End_Critical_Section();
+			break;
+		}
+		hda->end_done++;
+		if(batch_locks > 0)
+			batch_locks--;
+		End_Critical_Section();
+
+		FBHDA_access_end(0);
+	}
+}
+
+BOOL FBHDA_batch(FBHDA_batch_op_t *ops_in, DWORD cnt)
+{
+	FBHDA_batch_op_t ops[FBHDA_BATCH_MAX];
+	DWORD i;
+
+	/* ops are from ring 3, they couldn't point to system arena */
+	if(ops_in == NULL || cnt > FBHDA_BATCH_MAX ||
+		(DWORD)ops_in >= 0xC0000000UL - sizeof(ops))
+	{
+		return FALSE;
+	}
+
+	/* read user memory only once */
+	memcpy(ops, ops_in, cnt*sizeof(FBHDA_batch_op_t));
+
+	FBHDA_batch_drain();
+
+	for(i = 0; i < cnt; i++)
+	{
+		FBHDA_batch_op_t *op = &ops[i];
+
+		switch(op->op)
+		{
+			case FBHDA_BATCH_RECT:
+				FBHDA_access_rect(op->a, op->b, op->c, op->d);
+				batch_locks++;
+				sys_event_arm(&batch_event, BATCH_INTERVAL);
+				break;
+			case FBHDA_BATCH_BEGIN:
+				FBHDA_access_begin(op->a);
+				batch_locks++;
+				sys_event_arm(&batch_event, BATCH_INTERVAL);
+				break;
+			case FBHDA_BATCH_END:
+				if(batch_locks > 0)
+					batch_locks--;
+				FBHDA_access_end(op->a);
+				break;
+			case FBHDA_BATCH_MOUSE_MOVE:
+				mouse_move(op->a, op->b);
+				break;
+			case FBHDA_BATCH_PALETTE:
+				FBHDA_palette_set(op->a & 0xFF, op->b);
+				break;
+			default:
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 void FBHDA_clean()
 {
 	FBHDA_access_begin(0);
-	memset(hda->vram_pm32, 0, hda->stride);
+	fb_memset(hda->vram_pm32, 0, hda->stride);
 	FBHDA_access_end(0);
 }
 
@@ -282,6 +738,89 @@ BOOL FBHDA_gamma_set(VOID FBPTR ramp, DWORD buffer_size)
 	return FALSE;
 }
 
+/*
+ * Write combining for LFB by MTRR.VXD. In debug build write bandwidth is
+ * measured before and after and logged, so the effect can be checked.
+ * Benchmark overwrites top 64 kB of VRAM, it's called from init only.
+ */
+#ifdef DBGPRINT
+#define WC_BENCH_SIZE (64*1024)
+#define WC_BENCH_MS   20
+#define WC_BENCH_MAX  64 /* 4 MB, in case that system time isn't running */
+
+/* return write speed to top of VRAM in MB/s, 0 = cannot measure */
+static DWORD FBHDA_bench_write()
+{
+	BYTE *ptr;
+	DWORD t, t_end;
+	DWORD i;
+	DWORD bytes = 0;
+
+	if(hda->vram_pm32 == NULL || hda->vram_size < WC_BENCH_SIZE)
+	{
+		return 0;
+	}
+	ptr = ((BYTE*)hda->vram_pm32) + hda->vram_size - WC_BENCH_SIZE;
+
+	/* start on tick edge */
+	t = Get_System_Time();
+	for(i = 0; i < 1000000 && Get_System_Time() == t; i++);
+	t = Get_System_Time();
+
+	for(i = 0; i < WC_BENCH_MAX; i++)
+	{
+		fb_memset(ptr, 0, WC_BENCH_SIZE);
+		bytes += WC_BENCH_SIZE;
+		t_end = Get_System_Time();
+		if(t_end - t >= WC_BENCH_MS)
+		{
+			break;
+		}
+	}
+
+	if(t_end == t)
+	{
+		return 0;
+	}
+
+	return bytes / (t_end - t) / 1000;
+}
+#endif
+
+BOOL FBHDA_write_combine(DWORD phy, DWORD size)
+{
+#ifdef DBGPRINT
+	DWORD bw_uc, bw_wc;
+#endif
+
+	if(phy < 1*1024*1024)
+	{
+		return FALSE;
+	}
+
+	if(!MTRR_GetVersion())
+	{
+		dbg_printf("MTRR unsupported\n");
+		return FALSE;
+	}
+
+#ifdef DBGPRINT
+	bw_uc = FBHDA_bench_write();
+#endif
+	if(MTRR_SetPhysicalCacheTypeRange(phy, 0, size, MTRR_FRAMEBUFFERCACHED) != MTRR_STATUS_SUCCESS)
+	{
+		dbg_printf("MTRR set failed\n");
+		return FALSE;
+	}
+#ifdef DBGPRINT
+	bw_wc = FBHDA_bench_write();
+
+	dbg_printf("VRAM write: %ld MB/s uncached, %ld MB/s write combined\n", bw_uc, bw_wc);
+#endif
+
+	return TRUE;
+}
+
 #define TEST_PATTERN 0xAAAAAAAAUL
 
 void FBHDA_memtest()
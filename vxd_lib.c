@@ -85,6 +85,251 @@ void *memcpy(void *dst, const void *src, unsigned int size)
 	return dst;
 }
 
+#define CPUID_FEAT_MMX  (1UL << 23)
+#define CPUID_FEAT_FXSR (1UL << 24)
+#define CPUID_FEAT_SSE2 (1UL << 26)
+#define CR4_OSFXSR      (1UL << 9)
+
+static DWORD cpu_simd_level = ~0UL;
+
+DWORD cpu_simd()
+{
+#ifndef I486
+	DWORD has_cpuid = 0;
+	DWORD features = 0;
+	DWORD cr4_val = 0;
+
+	if(cpu_simd_level != ~0UL)
+	{
+		return cpu_simd_level;
+	}
+
+	cpu_simd_level = CPU_SIMD_NONE;
+
+	/* 486 may not have CPUID, test if EFLAGS.ID is writable */
+	_asm
+	{
+		.586p
+		push eax
+		push ecx
+		pushfd
+		pop eax
+		mov ecx, eax
+		xor eax, 00200000h
+		push eax
+		popfd
+		pushfd
+		pop eax
+		push ecx
+		popfd
+		xor eax, ecx
+		and eax, 00200000h
+		mov [has_cpuid], eax
+		pop ecx
+		pop eax
+	}
+
+	if(has_cpuid)
+	{
+		_asm
+		{
+			.586p
+			push eax
+			push ebx
+			push ecx
+			push edx
+			mov eax, 1
+			cpuid
+			mov [features], edx
+			pop edx
+			pop ecx
+			pop ebx
+			pop eax
+		}
+	}
+
+	if(features & CPUID_FEAT_MMX)
+	{
+		cpu_simd_level = CPU_SIMD_MMX;
+	}
+
+	if((features & (CPUID_FEAT_FXSR | CPUID_FEAT_SSE2)) == (CPUID_FEAT_FXSR | CPUID_FEAT_SSE2))
+	{
+		/* SSE is usable only when OS enabled it (W98SE+) */
+		_asm
+		{
+			.586p
+			push eax
+			mov eax, cr4
+			mov [cr4_val], eax
+			pop eax
+		}
+
+		if(cr4_val & CR4_OSFXSR)
+		{
+			cpu_simd_level = CPU_SIMD_SSE2;
+		}
+	}
+
+	dbg_printf("cpu_simd: cpuid %lX, SIMD: %ld\n", features, cpu_simd_level);
+
+	return cpu_simd_level;
+#else
+	return CPU_SIMD_NONE;
+#endif
+}
+
+/*
+ * Framebuffer copy and fill. VRAM is mapped uncached or write-combined,
+ * so write it by full DWORDs in one sequential stream (rep movsd/stosd).
+ * With SSE2 use MOVNTI, non-temporal stores don't pollute the cache and
+ * don't need FPU/XMM state save (we can be called from any context).
+ */
+#define FB_STREAM_MIN 256 /* in DWORDs */
+
+void fb_memset(void *dst, int c, unsigned int size)
+{
+	unsigned int par;
+	unsigned int dw_count;
+	unsigned int i;
+
+	c &= 0xFF;
+	par = (c << 24) | (c << 16) | (c << 8) | c;
+	dw_count = size >> 2;
+
+#ifndef I486
+	if(dw_count >= FB_STREAM_MIN && cpu_simd() == CPU_SIMD_SSE2)
+	{
+		_asm
+		{
+			.686
+			.xmm2
+			push eax
+			push ecx
+			push edi
+			mov edi, [dst]
+			mov eax, [par]
+			mov ecx, [dw_count]
+		fb_memset_nt_loop:
+			movnti [edi], eax
+			add edi, 4
+			dec ecx
+			jnz fb_memset_nt_loop
+			sfence
+			pop edi
+			pop ecx
+			pop eax
+		}
+	}
+	else
+#endif
+	{
+		_asm
+		{
+			push eax
+			push ecx
+			push edi
+			mov edi, [dst]
+			mov eax, [par]
+			mov ecx, [dw_count]
+			cld
+			rep stosd
+			pop edi
+			pop ecx
+			pop eax
+		}
+	}
+
+	for(i = dw_count << 2; i < size; i++)
+	{
+		((unsigned char*)dst)[i] = c;
+	}
+}
+
+void fb_memcpy(void *dst, const void *src, unsigned int size)
+{
+	unsigned int dw_count;
+	unsigned int i;
+
+	dw_count = size >> 2;
+
+#ifndef I486
+	if(dw_count >= FB_STREAM_MIN && cpu_simd() == CPU_SIMD_SSE2)
+	{
+		_asm
+		{
+			.686
+			.xmm2
+			push eax
+			push ecx
+			push edx
+			push esi
+			push edi
+			push ebx
+			mov esi, [src]
+			mov edi, [dst]
+			mov ecx, [dw_count]
+			shr ecx, 2
+			jz fb_memcpy_nt_tail
+		fb_memcpy_nt_loop:
+			mov eax, [esi]
+			mov ebx, [esi+4]
+			mov edx, [esi+8]
+			movnti [edi], eax
+			mov eax, [esi+12]
+			movnti [edi+4], ebx
+			movnti [edi+8], edx
+			movnti [edi+12], eax
+			add esi, 16
+			add edi, 16
+			dec ecx
+			jnz fb_memcpy_nt_loop
+		fb_memcpy_nt_tail:
+			mov ecx, [dw_count]
+			and ecx, 3
+			jz fb_memcpy_nt_done
+		fb_memcpy_nt_tail_loop:
+			mov eax, [esi]
+			movnti [edi], eax
+			add esi, 4
+			add edi, 4
+			dec ecx
+			jnz fb_memcpy_nt_tail_loop
+		fb_memcpy_nt_done:
+			sfence
+			pop ebx
+			pop edi
+			pop esi
+			pop edx
+			pop ecx
+			pop eax
+		}
+	}
+	else
+#endif
+	{
+		_asm
+		{
+			push ecx
+			push esi
+			push edi
+			mov esi, [src]
+			mov edi, [dst]
+			mov ecx, [dw_count]
+			cld
+			rep movsd
+			pop edi
+			pop esi
+			pop ecx
+		}
+	}
+
+	for(i = dw_count << 2; i < size; i++)
+	{
+		((unsigned char*)dst)[i] = ((unsigned char*)src)[i];
+	}
+}
+
 int memcmp(const void *ptr1, const void *ptr2, unsigned int num)
 {
 	const unsigned char *p1 = (const unsigned char *)ptr1;
@@ -184,6 +429,51 @@ BOOL RegReadConf(UINT root, const char *path, const char *name, DWORD *out)
 	return rv;
 }
 
+/**
+ * Read binary value from registry, size is in/out
+ *
+ **/
+BOOL RegReadBin(UINT root, const char *path, const char *name, void *data, DWORD *size)
+{
+	DWORD hKey;
+	DWORD type;
+	BOOL rv = FALSE;
+	
+	if(_RegOpenKey(root, (char*)path, &hKey) == ERROR_SUCCESS)
+	{
+		if(_RegQueryValueEx(hKey, (char*)name, 0, &type, data, size) == ERROR_SUCCESS)
+		{
+			rv = (type == REG_BINARY);
+		}
+		
+		_RegCloseKey(hKey);
+	}
+	
+	return rv;
+}
+
+/**
+ * Write binary value to registry, key is created when missing
+ *
+ **/
+BOOL RegWriteBin(UINT root, const char *path, const char *name, const void *data, DWORD size)
+{
+	DWORD hKey;
+	BOOL rv = FALSE;
+	
+	if(_RegCreateKey(root, (char*)path, &hKey) == ERROR_SUCCESS)
+	{
+		if(_RegSetValueEx(hKey, (char*)name, 0, REG_BINARY, (BYTE*)data, size) == ERROR_SUCCESS)
+		{
+			rv = TRUE;
+		}
+		
+		_RegCloseKey(hKey);
+	}
+	
+	return rv;
+}
+
 /**
  * VMM calls wrapers
  **/
@@ -202,6 +492,84 @@ DWORD Get_VMM_Version()
 	return ver;
 }
 
+/* system time in ms since Windows start */
+DWORD Get_System_Time()
+{
+	DWORD t = 0;
+
+	_asm push eax
+	VMMCall(Get_System_Time);
+	_asm mov [t],eax
+	_asm pop eax
+
+	return t;
+}
+
+/* one shot timer, callback gets refdata in EDX, returns handle (0 = fail) */
+DWORD Set_Global_Time_Out(DWORD ms, DWORD refdata, void *callback)
+{
+	DWORD handle = 0;
+
+	_asm
+	{
+		push eax
+		push edx
+		push esi
+		mov eax, [ms]
+		mov edx, [refdata]
+		mov esi, [callback]
+	}
+	VMMCall(Set_Global_Time_Out);
+	_asm
+	{
+		mov [handle],esi
+		pop esi
+		pop edx
+		pop eax
+	}
+
+	return handle;
+}
+
+/*
+ * Time-out callbacks run asynchronously and must not block, they could only
+ * schedule event, callback of event gets VM in EBX and refdata in EDX and
+ * with PEF_Wait_Not_Crit is allowed to wait on semaphores.
+ */
+DWORD Call_Priority_VM_Event(DWORD boost, DWORD vm, DWORD flags, DWORD refdata, void *callback, DWORD timeout)
+{
+	DWORD handle = 0;
+
+	_asm
+	{
+		push eax
+		push ebx
+		push ecx
+		push edx
+		push esi
+		push edi
+		mov eax, [boost]
+		mov ebx, [vm]
+		mov ecx, [flags]
+		mov edx, [refdata]
+		mov esi, [callback]
+		mov edi, [timeout]
+	}
+	VMMCall(Call_Priority_VM_Event);
+	_asm
+	{
+		mov [handle],esi
+		pop edi
+		pop esi
+		pop edx
+		pop ecx
+		pop ebx
+		pop eax
+	}
+
+	return handle;
+}
+
 void *Get_Cur_VM_Handle()
 {
 	void *handle = 0;
@@ -214,6 +582,85 @@ void *Get_Cur_VM_Handle()
 	return handle;
 }
 
+void *Get_Cur_Thread_Handle()
+{
+	void *handle = 0;
+
+	_asm push edi
+	VMMCall(Get_Cur_Thread_Handle);
+	_asm mov [handle],edi
+	_asm pop edi
+
+	return handle;
+}
+
+void *Get_Sys_VM_Handle()
+{
+	void *handle = 0;
+
+	_asm push ebx
+	VMMCall(Get_Sys_VM_Handle);
+	_asm mov [handle],ebx
+	_asm pop ebx
+
+	return handle;
+}
+
+static void __cdecl sys_event_run(sys_event_t *se)
+{
+	se->event = 0;
+	se->proc();
+}
+
+/* event callback, sys_event_t is in EDX */
+static void __declspec(naked) sys_event_entry()
+{
+	_asm
+	{
+		pushad
+		push edx
+		call sys_event_run
+		add esp, 4
+		popad
+		ret
+	}
+}
+
+/* time-out, async context: nothing here could block */
+static void __cdecl sys_event_timer(sys_event_t *se)
+{
+	se->timer = 0;
+
+	if(se->event == 0)
+	{
+		se->event = Call_Priority_VM_Event(Low_Pri_Device_Boost, (DWORD)Get_Sys_VM_Handle(),
+			PEF_Wait_For_STI | PEF_Wait_Not_Crit | PEF_Always_Sched, (DWORD)se, (void*)sys_event_entry, 0);
+	}
+}
+
+/* time-out callback, sys_event_t is in EDX */
+static void __declspec(naked) sys_event_timer_entry()
+{
+	_asm
+	{
+		pushad
+		push edx
+		call sys_event_timer
+		add esp, 4
+		popad
+		ret
+	}
+}
+
+/* run se->proc in system VM after ms, nothing is done when it's already pending */
+void sys_event_arm(sys_event_t *se, DWORD ms)
+{
+	if(se->timer == 0 && se->event == 0)
+	{
+		se->timer = Set_Global_Time_Out(ms, (DWORD)se, (void*)sys_event_timer_entry);
+	}
+}
+
 volatile void __cdecl Begin_Critical_Section(ULONG Flags)
 {
 	_asm push ecx
@@ -517,6 +964,16 @@ DWORD __declspec(naked) __cdecl _RegQueryValueEx(DWORD hKey, char *lpszValueName
 	VMMJmp(_RegQueryValueEx);
 }
 
+DWORD __declspec(naked) __cdecl _RegCreateKey(DWORD hKey, char *lpszSubKey, DWORD *lphKey)
+{
+	VMMJmp(_RegCreateKey);
+}
+
+DWORD __declspec(naked) __cdecl _RegSetValueEx(DWORD hKey, char *lpszValueName, DWORD dwReserved, DWORD dwType, BYTE *lpbData, DWORD cbData)
+{
+	VMMJmp(_RegSetValueEx);
+}
+
 DWORD __declspec(naked) __cdecl _PageModifyPermissions(ULONG page, ULONG npages, ULONG permand, ULONG permor)
 {
 	VMMJmp(_PageModifyPermissions);
@@ -542,6 +999,11 @@ DWORD __declspec(naked) __cdecl _PageCommitPhys(ULONG page, ULONG npages, ULONG
 	VMMJmp(_PageCommitPhys);
 }
 
+DWORD __declspec(naked) __cdecl _PageDecommit(ULONG page, ULONG npages, ULONG flags)
+{
+	VMMJmp(_PageDecommit);
+}
+
 DWORD __declspec(naked) __cdecl _PageCommitContig(ULONG page, ULONG npages, ULONG flags, ULONG alignmask, ULONG minphys, ULONG maxphys)
 {
 	VMMJmp(_PageCommitContig);
@@ -28,13 +28,46 @@ void memset(void *dst, int c, unsigned int size);
 void *memcpy(void *dst, const void *src, unsigned int size);
 int memcmp(const void *ptr1, const void *ptr2, unsigned int num);
 unsigned int strlen(const char *s);
+
+/* copy/fill for framebuffer (and other write-combined) memory */
+void fb_memset(void *dst, int c, unsigned int size);
+void fb_memcpy(void *dst, const void *src, unsigned int size);
+
+#define CPU_SIMD_NONE 0
+#define CPU_SIMD_MMX  1
+#define CPU_SIMD_SSE2 2
+
+DWORD cpu_simd();
 char *strcpy(char *dst, const char *src);
 char *strcat(char *dst, const char *src);
 
 BOOL RegReadConf(UINT root, const char *path, const char *name, DWORD *out);
+BOOL RegReadBin(UINT root, const char *path, const char *name, void *data, DWORD *size);
+BOOL RegWriteBin(UINT root, const char *path, const char *name, const void *data, DWORD size);
 
 DWORD Get_VMM_Version();
+DWORD Get_System_Time();
+DWORD Set_Global_Time_Out(DWORD ms, DWORD refdata, void *callback);
+DWORD Call_Priority_VM_Event(DWORD boost, DWORD vm, DWORD flags, DWORD refdata, void *callback, DWORD timeout);
+
+/* Call_Priority_VM_Event boost and flags */
+#define Low_Pri_Device_Boost 0x00000010
+#define PEF_Wait_For_STI     0x00000001
+#define PEF_Wait_Not_Crit    0x00000002
+#define PEF_Always_Sched     0x00000008
 void *Get_Cur_VM_Handle();
+void *Get_Cur_Thread_Handle();
+void *Get_Sys_VM_Handle();
+
+/* time-out which runs proc as system VM event, so proc could block */
+typedef struct sys_event
+{
+	volatile DWORD timer;
+	volatile DWORD event;
+	void (*proc)();
+} sys_event_t;
+
+void sys_event_arm(sys_event_t *se, DWORD ms);
 ULONG __cdecl _PageAllocate(ULONG nPages, ULONG pType, ULONG VM, ULONG AlignMask, ULONG minPhys, ULONG maxPhys, ULONG *PhysAddr, ULONG flags);
 ULONG __cdecl _PageFree(PVOID hMem, DWORD flags);
 ULONG __cdecl _CopyPageTable(ULONG LinPgNum, ULONG nPages, DWORD *PageBuf, ULONG flags);
@@ -46,6 +79,8 @@ ULONG __cdecl _PhysIntoV86(ULONG PhysPage, ULONG VM, ULONG VMLinPgNum, ULONG nPa
 DWORD __cdecl _RegOpenKey(DWORD hKey, char *lpszSubKey, DWORD *lphKey);
 DWORD __cdecl _RegCloseKey(DWORD hKey);
 DWORD __cdecl _RegQueryValueEx(DWORD hKey, char *lpszValueName, DWORD *lpdwReserved, DWORD *lpdwType, BYTE *lpbData, DWORD *lpcbData);
+DWORD __cdecl _RegCreateKey(DWORD hKey, char *lpszSubKey, DWORD *lphKey);
+DWORD __cdecl _RegSetValueEx(DWORD hKey, char *lpszValueName, DWORD dwReserved, DWORD dwType, BYTE *lpbData, DWORD cbData);
 DWORD __cdecl _PageModifyPermissions(ULONG page, ULONG npages, ULONG permand, ULONG permor);
 volatile void __cdecl Begin_Critical_Section(ULONG Flags);
 volatile void __cdecl End_Critical_Section();
@@ -60,6 +95,7 @@ DWORD __cdecl _GetFreePageCount(DWORD *pLockablePages);
 DWORD __cdecl _PageReserve(ULONG page, ULONG npages, ULONG flags);
 DWORD __cdecl _PageCommit(ULONG page, ULONG npages, ULONG hpd, ULONG pagerdata, ULONG flags);
 DWORD __cdecl _PageCommitPhys(ULONG page, ULONG npages, ULONG physpg, ULONG flags);
+DWORD __cdecl _PageDecommit(ULONG page, ULONG npages, ULONG flags);
 DWORD __cdecl _PageReAllocate(ULONG hMem, ULONG nPages, ULONG flags);
 DWORD __cdecl _PageCommitContig(ULONG page, ULONG npages, ULONG flags, ULONG alignmask, ULONG minphys, ULONG maxphys);
 DWORD __cdecl _LinMapIntoV86(ULONG HLinPgNum, ULONG VM, ULONG VMLinPgNum, ULONG nPages, ULONG flags);
@@ -117,3 +153,4 @@ BOOL VPICD_Virtualize_IRQ(struct _VPICD_IRQ_Descriptor *vid);
 /* extra FBHA */
 void FBHDA_update_heap_size(BOOL init, BOOL ram);
 void FBHDA_memtest();
+BOOL FBHDA_write_combine(DWORD phy, DWORD size);
@@ -361,6 +361,9 @@ WORD __stdcall VXD_API_Proc(PCRS_32 state)
 	//dbg_printf("VXD_API_Proc, service: %X\n", service);
 	//Begin_Critical_Section(0);
 	
+	/* finish drawing of DRV before anything else (see FBHDA_batch_drain) */
+	FBHDA_batch_drain();
+	
 	switch(service)
 	{
 		case VXD_PM16_VERSION:
@@ -399,6 +402,26 @@ WORD __stdcall VXD_API_Proc(PCRS_32 state)
 				rc = 1;
 				break;
 			}
+		case OP_FBHDA_SWAP_EX:
+			{
+				BOOL rs;
+				rs = FBHDA_swap_ex(state->Client_ECX, state->Client_EBX);
+				state->Client_ECX = (DWORD)rs;
+				rc = 1;
+				break;
+			}
+		case OP_FBHDA_PRESENT_STATS:
+			state->Client_ECX = FBHDA_present_stats((FBHDA_present_stats_t *)state->Client_EDI);
+			rc = 1;
+			break;
+		case OP_FBHDA_WAIT_VBLANK:
+			state->Client_ECX = FBHDA_wait_vblank();
+			rc = 1;
+			break;
+		case OP_FBHDA_BATCH:
+			state->Client_ECX = FBHDA_batch((FBHDA_batch_op_t *)state->Client_EDI, state->Client_ECX);
+			rc = 1;
+			break;
 		case OP_FBHDA_CLEAN:
 			FBHDA_clean();
 			rc = 1;
@@ -415,6 +438,10 @@ WORD __stdcall VXD_API_Proc(PCRS_32 state)
 			rc = 1;
 			break;
 		}
+		case OP_FBHDA_PALETTE_SET_RANGE:
+			FBHDA_palette_set_range(state->Client_ECX, state->Client_EBX, (DWORD *)state->Client_ESI);
+			rc = 1;
+			break;
 		case OP_FBHDA_GAMMA_GET:
 			state->Client_ECX = FBHDA_gamma_get((void *)state->Client_EDI, state->Client_ECX);
 			rc = 1;
@@ -804,6 +831,8 @@ DWORD __stdcall Device_IO_Control_proc(DWORD vmhandle, struct DIOCParams *params
 	
 	//dbg_printf("I%x\n", params->dwIoControlCode);
 	
+	FBHDA_batch_drain();
+	
 	switch(params->dwIoControlCode)
 	{
 		/* DX */
@@ -844,6 +873,30 @@ DWORD __stdcall Device_IO_Control_proc(DWORD vmhandle, struct DIOCParams *params
 			outBuf[0] = FBHDA_swap(inBuf[0]);
 			rc = 0;
 			break;
+		case OP_FBHDA_SWAP_EX:
+			outBuf[0] = FBHDA_swap_ex(inBuf[0], inBuf[1]);
+			rc = 0;
+			break;
+		case OP_FBHDA_PRESENT_STATS:
+			{
+				FBHDA_present_stats_t *stats = (FBHDA_present_stats_t *)&outBuf[1];
+				stats->cb = sizeof(FBHDA_present_stats_t);
+				outBuf[0] = FBHDA_present_stats(stats);
+				rc = 0;
+				break;
+			}
+		case OP_FBHDA_WAIT_VBLANK:
+			outBuf[0] = FBHDA_wait_vblank();
+			rc = 0;
+			break;
+		case OP_FBHDA_BATCH:
+			if(inBuf != NULL && params->cbInBuffer >= 2*sizeof(DWORD) &&
+				outBuf != NULL && params->cbOutBuffer >= sizeof(DWORD))
+			{
+				outBuf[0] = FBHDA_batch((FBHDA_batch_op_t *)inBuf[0], inBuf[1]);
+				rc = 0;
+			}
+			break;
 		case OP_FBHDA_CLEAN:
 			FBHDA_clean();
 			rc = 0;
@@ -856,6 +909,10 @@ DWORD __stdcall Device_IO_Control_proc(DWORD vmhandle, struct DIOCParams *params
 			outBuf[0] = FBHDA_palette_get(inBuf[0]);
 			rc = 0;
 			break;
+		case OP_FBHDA_PALETTE_SET_RANGE:
+			FBHDA_palette_set_range(inBuf[0], inBuf[1], (DWORD *)inBuf[2]);
+			rc = 0;
+			break;
 		case OP_FBHDA_OVERLAY_SETUP:
 			outBuf[0] = FBHDA_overlay_setup(inBuf[0], inBuf[1], inBuf[2], inBuf[3]);
 			rc = 0;
@@ -895,6 +952,10 @@ DWORD __stdcall Device_IO_Control_proc(DWORD vmhandle, struct DIOCParams *params
 				SVGA_CMB_submit_io_t *inio  = (SVGA_CMB_submit_io_t*)inBuf;
 				SVGA_CMB_status_t *status = (SVGA_CMB_status_t*)outBuf;
 				
+				/* bring back evicted regions used by this command buffer */
+				SVGA_region_lru_restore();
+				/* make room for surfaces and pin MOBs bound by this command buffer */
+				SVGA_CMB_scan(inio->cmb, inio->cmb_size);
 				SVGA_CMB_submit(inio->cmb, inio->cmb_size, status, inio->flags, inio->DXCtxId);
 				rc = 0;
 				break;
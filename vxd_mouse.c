@@ -43,6 +43,7 @@ static void *mouse_buffer_mem = NULL;
 static void *mouse_andmask_data = NULL;
 static void *mouse_xormask_data = NULL;
 static void *mouse_swap_data = NULL;
+static void *mouse_swap_back = NULL; /* second swap buffer for draw_move */
 static DWORD mouse_mem_size = 0;
 
 static int mouse_x = 0;
@@ -63,8 +64,48 @@ static BOOL  mouse_valid = FALSE;
 static BOOL  mouse_empty = FALSE;
 static BOOL  mouse_visible  = FALSE;
 
+/* cursor move: erase is postponed and merged with blit */
+static void *mouse_move_req = NULL; /* thread which requested the move */
+static BOOL  mouse_move_deferred = FALSE;
+
+/*
+ * coalesced moves: only last position is drawn, at most once per interval.
+ * Pending position is guarded by critical section, time-out only schedules
+ * event on system VM and drawing is done there (under hda_sem).
+ */
+#define MOUSE_MOVE_INTERVAL 8
+
+static BOOL  mouse_pend = FALSE;
+static int   mouse_pend_x = 0;
+static int   mouse_pend_y = 0;
+static DWORD mouse_draw_time = 0;
+
+static void mouse_event_proc();
+static sys_event_t mouse_event = {0, 0, mouse_event_proc};
+
 #define CUR_MIN_SIZE (32*32*4)
 
+/* recently loaded cursor shapes */
+#define MOUSE_CACHE_SIZE 8
+
+typedef struct _mouse_cache_t
+{
+	DWORD serial;     /* 0 = empty slot */
+	DWORD hash;
+	DWORD shape_size; /* CURSORSHAPE + masks as passed by GDI */
+	DWORD ps;         /* bytes per pixel of converted masks, 0 = no masks */
+	DWORD used;       /* LRU stamp */
+	DWORD mem_size;
+	void *shape;
+	void *andmask;
+	void *xormask;
+	BOOL empty;
+} mouse_cache_t;
+
+static mouse_cache_t mouse_cache[MOUSE_CACHE_SIZE];
+static DWORD mouse_cache_serial = 0;
+static DWORD mouse_cache_stamp = 0;
+
 #include "vxd_strings.h"
 
 #include "vxd_mouse_conv.h"
@@ -79,6 +120,136 @@ void *mouse_buffer()
 	return mouse_buffer_mem;
 }
 
+static DWORD mouse_shape_size(CURSORSHAPE *cur)
+{
+	DWORD s;
+	
+	/* masks are stored with cbWidth stride */
+	if(cur->cbWidth < (cur->cx + 7)/8)
+		return 0;
+	
+	s = cur->cbWidth * cur->cy; /* AND mask */
+	
+	if(s == 0)
+		return 0;
+	
+	if(cur->BitsPixel == 1)
+	{
+		s += cur->cbWidth * cur->cy;
+	}
+	else
+	{
+		s += ((cur->BitsPixel + 7)/8) * cur->cx * cur->cy;
+	}
+	
+	s += sizeof(CURSORSHAPE);
+	
+	if(s > MOUSE_BUFFER_SIZE)
+		return 0;
+	
+	return s;
+}
+
+/* FNV-1a over DWORDs */
+static DWORD mouse_shape_hash(void *data, DWORD size)
+{
+	DWORD *ptr = data;
+	BYTE *tail;
+	DWORD h = 2166136261UL;
+	DWORD i;
+	
+	for(i = 0; i < size/4; i++)
+	{
+		h = (h ^ ptr[i]) * 16777619UL;
+	}
+	
+	tail = (BYTE*)(ptr + i);
+	for(i = 0; i < (size & 3); i++)
+	{
+		h = (h ^ tail[i]) * 16777619UL;
+	}
+	
+	return h;
+}
+
+/*
+ * Find cursor shape in cache or take free/least used slot for it.
+ * mask_size is size of each converted mask (0 when not needed).
+ * On miss is shape copied to slot and *hit is FALSE,
+ * masks have to be converted by caller.
+ */
+static mouse_cache_t *mouse_cache_get(CURSORSHAPE *cur, DWORD mask_size, DWORD ps, BOOL *hit)
+{
+	DWORD size = mouse_shape_size(cur);
+	DWORD hash;
+	DWORD need;
+	mouse_cache_t *c;
+	mouse_cache_t *victim = NULL;
+	int i;
+	
+	if(size == 0)
+		return NULL;
+	
+	hash = mouse_shape_hash(cur, size);
+	
+	for(i = 0; i < MOUSE_CACHE_SIZE; i++)
+	{
+		c = &mouse_cache[i];
+		if(c->serial == 0)
+		{
+			if(victim == NULL || victim->serial != 0)
+				victim = c;
+			continue;
+		}
+		
+		if(c->hash == hash && c->shape_size == size && c->ps == ps)
+		{
+			if(memcmp(c->shape, cur, size) == 0)
+			{
+				c->used = ++mouse_cache_stamp;
+				*hit = TRUE;
+				return c;
+			}
+		}
+		
+		if(victim == NULL || (victim->serial != 0 && c->used < victim->used))
+			victim = c;
+	}
+	
+	c = victim;
+	need = ((size + 3) & 0xFFFFFFFCUL) + 2*mask_size;
+	if(need > c->mem_size)
+	{
+		if(c->shape)
+			_PageFree(c->shape, 0);
+		
+		c->shape = (void*)_PageAllocate(RoundToPages(need), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
+		c->mem_size = c->shape ? RoundToPages(need) * P_SIZE : 0;
+	}
+	
+	if(c->shape == NULL)
+	{
+		c->serial = 0;
+		return NULL;
+	}
+	
+	memcpy(c->shape, cur, size);
+	c->andmask = ((BYTE*)c->shape) + ((size + 3) & 0xFFFFFFFCUL);
+	c->xormask = ((BYTE*)c->andmask) + mask_size;
+	c->hash = hash;
+	c->shape_size = size;
+	c->ps = ps;
+	c->used = ++mouse_cache_stamp;
+	c->empty = FALSE;
+	
+	if(++mouse_cache_serial == 0)
+		mouse_cache_serial = 1;
+	c->serial = mouse_cache_serial;
+	
+	*hit = FALSE;
+	return c;
+}
+
 static void mouse_notify_accel()
 {
 	if(mouse_valid && mouse_visible && !mouse_empty)
@@ -91,6 +262,60 @@ static void mouse_notify_accel()
 	}
 }
 
+static void mouse_pend_set(int x, int y)
+{
+	Begin_Critical_Section(0);
+	mouse_pend_x = x;
+	mouse_pend_y = y;
+	mouse_pend = TRUE;
+	End_Critical_Section();
+}
+
+/* cursor is going to be redrawn, use last requested position */
+static void mouse_pend_take()
+{
+	Begin_Critical_Section(0);
+	if(mouse_pend)
+	{
+		mouse_x = mouse_pend_x;
+		mouse_y = mouse_pend_y;
+		mouse_pend = FALSE;
+	}
+	End_Critical_Section();
+}
+
+static void mouse_move_flush()
+{
+	if(!mouse_pend)
+		return;
+	
+	/* set before lock is taken, so only the same thread could see it in erase */
+	mouse_move_req = Get_Cur_Thread_Handle();
+	FBHDA_access_begin(FBHDA_ACCESS_MOUSE_MOVE);
+	mouse_move_req = NULL;
+	mouse_pend_take();
+	FBHDA_access_end(FBHDA_ACCESS_MOUSE_MOVE);
+	
+	mouse_draw_time = Get_System_Time();
+}
+
+/* system VM event, could wait on hda_sem */
+static void mouse_event_proc()
+{
+	/* deferred end of DRV would keep cursor erased */
+	FBHDA_batch_drain();
+	
+	if(mouse_valid && mouse_visible && !mouse_empty)
+	{
+		/* when cursor is erased by running drawing, this only updates position */
+		mouse_move_flush();
+	}
+	else
+	{
+		mouse_pend_take();
+	}
+}
+
 BOOL mouse_load()
 {
 	DWORD ms = 0;
@@ -98,25 +323,32 @@ BOOL mouse_load()
 	void *xormask_ptr;
 	CURSORSHAPE *cur;
 	DWORD cbw;
+	mouse_cache_t *c;
+	BOOL hit = FALSE;
 	
 	//dbg_printf(dbg_mouse_load);
 	
 	if(!mouse_buffer_mem) return FALSE;
-		
+	
+	cur = (CURSORSHAPE*)mouse_buffer_mem;
+	
 #ifdef SVGA
 	if(SVGA_mouse_hw())
 	{
-		BOOL r = SVGA_mouse_load();
+		BOOL r;
+		
+		/* device holds only one cursor, cache is used to detect same shape */
+		c = mouse_cache_get(cur, 0, 0, &hit);
+		r = SVGA_mouse_load(c ? c->serial : 0);
 		mouse_valid = FALSE;
 		mouse_notify_accel();
 		return r;
 	}
 #endif
 
-	cur = (CURSORSHAPE*)mouse_buffer_mem;
-	
 	/* erase cursor if present */
 	FBHDA_access_begin(FBHDA_ACCESS_MOUSE_MOVE);
+	mouse_pend_take();
 	
 	mouse_valid = FALSE;
 	
@@ -127,31 +359,27 @@ BOOL mouse_load()
 	
 	if(ms > mouse_mem_size)
 	{
-		if(mouse_andmask_data)
-			_PageFree(mouse_andmask_data, 0);
-		
-		if(mouse_xormask_data)
-			_PageFree(mouse_xormask_data, 0);
-			
 		if(mouse_swap_data)
 			_PageFree(mouse_swap_data, 0);
-			
-		mouse_andmask_data = 
-			(void*)_PageAllocate(RoundToPages(ms), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
 		
-		mouse_xormask_data = 
+		if(mouse_swap_back)
+			_PageFree(mouse_swap_back, 0);
+			
+		mouse_swap_data = 
 			(void*)_PageAllocate(RoundToPages(ms), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
 		
-		mouse_swap_data = 
+		mouse_swap_back = 
 			(void*)_PageAllocate(RoundToPages(ms), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
 			
-		mouse_mem_size = ms;
+		mouse_mem_size = mouse_swap_data ? ms : 0;
 	}
 	
+	mouse_ps = (hda->bpp + 7) / 8;
+	
+	c = mouse_cache_get(cur, ms, mouse_ps, &hit);
+	
 	/* can't allocate memory */
-	if(mouse_andmask_data == NULL ||
-		mouse_xormask_data == NULL ||
-		mouse_swap_data == NULL)
+	if(c == NULL || mouse_swap_data == NULL)
 	{
 		dbg_printf(dbg_mouse_no_mem);
 		FBHDA_access_end(FBHDA_ACCESS_MOUSE_MOVE);
@@ -163,31 +391,37 @@ BOOL mouse_load()
 	mouse_pointx = cur->xHotSpot;
 	mouse_pointy = cur->yHotSpot;
 	
-	andmask_ptr = (void*)(cur + 1);
-	xormask_ptr = (void*)(((BYTE*)andmask_ptr) + cur->cbWidth*cur->cy);
-	
-	mouse_ps = (hda->bpp + 7) / 8;
-	
-	cbw = (mouse_w+7)/8;
+	mouse_andmask_data = c->andmask;
+	mouse_xormask_data = c->xormask;
 	
-	/* AND mask (always 1bpp) */
-	convmask(cur, cbw, andmask_ptr, mouse_andmask_data);
-	
-	/* XOR mask (1bpp or screen bpp) */
-	if(cur->BitsPixel == 1)
-	{
-		convmask(cur, cbw, xormask_ptr, mouse_xormask_data);
-	}
-	else
+	if(!hit)
 	{
-		memcpy(mouse_xormask_data, xormask_ptr, 
-			((cur->BitsPixel + 7)/8) * cur->cx * cur->cy
-		);
+		andmask_ptr = (void*)(cur + 1);
+		xormask_ptr = (void*)(((BYTE*)andmask_ptr) + cur->cbWidth*cur->cy);
+		
+		cbw = (mouse_w+7)/8;
+		
+		/* AND mask (always 1bpp) */
+		convmask(cur, cbw, andmask_ptr, mouse_andmask_data);
+		
+		/* XOR mask (1bpp or screen bpp) */
+		if(cur->BitsPixel == 1)
+		{
+			convmask(cur, cbw, xormask_ptr, mouse_xormask_data);
+		}
+		else
+		{
+			memcpy(mouse_xormask_data, xormask_ptr, 
+				((cur->BitsPixel + 7)/8) * cur->cx * cur->cy
+			);
+		}
+		
+		c->empty = cursor_is_empty();
 	}
 	
 	mouse_valid = TRUE;
 	mouse_visible = TRUE;
-	mouse_empty = cursor_is_empty();
+	mouse_empty = c->empty;
 	
 	//dbg_printf(dbg_mouse_status, mouse_valid, mouse_visible, mouse_empty);
 	
@@ -215,15 +449,25 @@ void mouse_move(int x, int y)
 	
 	if(mouse_valid && mouse_visible && !mouse_empty)
 	{
-		FBHDA_access_begin(FBHDA_ACCESS_MOUSE_MOVE);
-		mouse_x = x;
-		mouse_y = y;
-		FBHDA_access_end(FBHDA_ACCESS_MOUSE_MOVE);
+		mouse_pend_set(x, y);
+		
+		/* swap buffer state is checked by mouse_erase under lock */
+		if(Get_System_Time() - mouse_draw_time >= MOUSE_MOVE_INTERVAL)
+		{
+			mouse_move_flush();
+		}
+		else
+		{
+			sys_event_arm(&mouse_event, MOUSE_MOVE_INTERVAL);
+		}
 	}
 	else
 	{
+		Begin_Critical_Section(0);
+		mouse_pend = FALSE;
 		mouse_x = x;
 		mouse_y = y;
+		End_Critical_Section();
 	}
 }
 
@@ -239,6 +483,7 @@ void mouse_show()
 	}
 #endif
 	FBHDA_access_begin(FBHDA_ACCESS_MOUSE_MOVE);
+	mouse_pend_take();
 	mouse_visible = TRUE;
 	FBHDA_access_end(FBHDA_ACCESS_MOUSE_MOVE);
 	
@@ -258,6 +503,7 @@ void mouse_hide()
 #endif
 	
 	FBHDA_access_begin(FBHDA_ACCESS_MOUSE_MOVE);
+	mouse_pend_take();
 	mouse_visible = FALSE;
 	FBHDA_access_end(FBHDA_ACCESS_MOUSE_MOVE);
 	
@@ -276,6 +522,7 @@ void mouse_invalidate()
 	}
 #endif
 	
+	mouse_pend_take();
 	mouse_valid = FALSE;
 	
 	mouse_notify_accel();
@@ -286,11 +533,20 @@ BOOL mouse_blit()
 {
 	if(mouse_valid && mouse_visible && !mouse_empty)
 	{
-		draw_save(mouse_x, mouse_y);
-		draw_blit(mouse_x, mouse_y);
+		if(mouse_move_deferred)
+		{
+			mouse_move_deferred = FALSE;
+			draw_move(mouse_x, mouse_y);
+		}
+		else
+		{
+			draw_save(mouse_x, mouse_y);
+			draw_blit(mouse_x, mouse_y);
+		}
 		return TRUE;
 	}
 	
+	mouse_move_deferred = FALSE;
 	return FALSE;
 }
 
@@ -299,6 +555,23 @@ void mouse_erase()
 {
 	if(mouse_valid && mouse_visible && !mouse_empty)
 	{
+		if(mouse_move_req != NULL && mouse_move_req == Get_Cur_Thread_Handle() && mouse_swap_valid)
+		{
+			/* keep cursor on screen, mouse_blit will move it */
+			mouse_move_deferred = TRUE;
+			return;
+		}
+		
+		draw_restore();
+	}
+}
+
+/* framebuffer is going to be touched while cursor move is pending */
+void mouse_move_cancel()
+{
+	if(mouse_move_deferred)
+	{
+		mouse_move_deferred = FALSE;
 		draw_restore();
 	}
 }
@@ -264,6 +264,132 @@ static void draw_blit(int mx, int my)
 	}
 }
 
+#define DEF_BLITBG(_bpp, _type) \
+static void blitbg ## _bpp(_type *screen, _type *bg, _type *and_line, _type *xor_line, int n) { \
+	int x; \
+	for(x = 0; x < n; x++) { \
+		screen[x] = (bg[x] & and_line[x]) ^ xor_line[x]; \
+} }
+
+DEF_BLITBG(8,  BYTE)
+DEF_BLITBG(16, WORD)
+DEF_BLITBG(32, DWORD)
+
+/*
+ * Move cursor which is still on screen (swap buffer is valid):
+ *  - save only newly exposed part of new rectangle, rest is
+ *    taken from old swap buffer
+ *  - restore only part of old rectangle which isn't covered by new one
+ *  - draw cursor from saved background (no VRAM read)
+ */
+static void draw_move(int mx, int my)
+{
+	BYTE *screen_pos = ((BYTE*)hda->vram_pm32) + hda->surface;
+	BYTE *old_buf = mouse_swap_data;
+	BYTE *new_buf = mouse_swap_back;
+	BYTE *screen;
+	BYTE *buf;
+	int ox = mouse_swap_x;
+	int oy = mouse_swap_y;
+	int ow = mouse_swap_w;
+	int oh = mouse_swap_h;
+	int nx, ny, nw, nh;
+	int ps = mouse_ps;
+	int cx, cy;
+	int y, l, r;
+
+	if(!mouse_swap_valid || new_buf == NULL)
+	{
+		draw_restore();
+		draw_save(mx, my);
+		draw_blit(mx, my);
+		return;
+	}
+
+	if(!calc_save(mx, my))
+	{
+		/* same as separate restore + save + blit */
+		mouse_swap_x = ox;
+		mouse_swap_y = oy;
+		mouse_swap_w = ow;
+		mouse_swap_h = oh;
+		mouse_swap_valid = TRUE;
+		draw_restore();
+		draw_blit(mx, my);
+		return;
+	}
+
+	nx = mouse_swap_x;
+	ny = mouse_swap_y;
+	nw = mouse_swap_w;
+	nh = mouse_swap_h;
+
+	l = (nx > ox) ? nx : ox;
+	r = (nx + nw < ox + ow) ? nx + nw : ox + ow;
+
+	/* save new background */
+	for(y = ny; y < ny + nh; y++)
+	{
+		screen = screen_pos + hda->pitch * y;
+		buf = new_buf + (y - ny) * nw * ps;
+		if(y >= oy && y < oy + oh && l < r)
+		{
+			BYTE *old_line = old_buf + (y - oy) * ow * ps;
+			memcpy(buf, screen + nx * ps, (l - nx) * ps);
+			memcpy(buf + (l - nx) * ps, old_line + (l - ox) * ps, (r - l) * ps);
+			memcpy(buf + (r - nx) * ps, screen + r * ps, (nx + nw - r) * ps);
+		}
+		else
+		{
+			memcpy(buf, screen + nx * ps, nw * ps);
+		}
+	}
+
+	/* restore uncovered part of old background */
+	for(y = oy; y < oy + oh; y++)
+	{
+		screen = screen_pos + hda->pitch * y;
+		buf = old_buf + (y - oy) * ow * ps;
+		if(y >= ny && y < ny + nh && l < r)
+		{
+			memcpy(screen + ox * ps, buf, (l - ox) * ps);
+			memcpy(screen + r * ps, buf + (r - ox) * ps, (ox + ow - r) * ps);
+		}
+		else
+		{
+			memcpy(screen + ox * ps, buf, ow * ps);
+		}
+	}
+
+	/* draw cursor over saved background */
+	cx = nx - (mx - mouse_pointx);
+	cy = ny - (my - mouse_pointy);
+	for(y = 0; y < nh; y++)
+	{
+		DWORD moff = (mouse_w * (cy + y) + cx) * ps;
+		BYTE *and_line = ((BYTE*)mouse_andmask_data) + moff;
+		BYTE *xor_line = ((BYTE*)mouse_xormask_data) + moff;
+		screen = screen_pos + hda->pitch * (ny + y) + nx * ps;
+		buf = new_buf + y * nw * ps;
+		switch(ps)
+		{
+			case 2:
+				blitbg16((WORD*)screen, (WORD*)buf, (WORD*)and_line, (WORD*)xor_line, nw);
+				break;
+			case 4:
+				blitbg32((DWORD*)screen, (DWORD*)buf, (DWORD*)and_line, (DWORD*)xor_line, nw);
+				break;
+			default: /* 8 and 24 bpp, masks are per byte */
+				blitbg8(screen, buf, and_line, xor_line, nw * ps);
+				break;
+		}
+	}
+
+	mouse_swap_back = old_buf;
+	mouse_swap_data = new_buf;
+	mouse_swap_valid = TRUE;
+}
+
 static void convmask(CURSORSHAPE *lpCursor, DWORD cbWidth, void *src, void *dst)
 {
 	switch(mouse_ps)
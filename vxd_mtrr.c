@@ -33,9 +33,26 @@ THE SOFTWARE.
 DWORD __cdecl MTRR_GetVersion()
 {
 	DWORD rc = 0;
+	DWORD ddb = 0;
+	
+	/* MTRR.VXD isn't present on all systems, VxDCall to missing device is fatal */
+	_asm push ecx
+	_asm push edi
+	_asm mov eax, MTRR_DEVICE_ID
+	_asm xor edi, edi
+	VMMCall(Get_DDB);
+	_asm mov [ddb], ecx
+	_asm pop edi
+	_asm pop ecx
+	
+	if(ddb == 0)
+	{
+		return 0;
+	}
+	
 	VxDCall(MTRR, Get_Version);
 	_asm and eax, 0xFFFF
-	_asm mov eax, [rc]
+	_asm mov [rc], eax
 	
 	return rc;
 }
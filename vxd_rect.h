@@ -0,0 +1,150 @@
+#ifndef __VXD_RECT_H__INCLUDED__
+#define __VXD_RECT_H__INCLUDED__
+
+/*
+ * Bounded list of dirty rectangles collected between FBHDA_access_begin/rect
+ * and FBHDA_access_end. Rectangles are merged only when the bounding box
+ * doesn't waste much area, so two small updates in opposite corners stay
+ * two small blits instead of one full screen blit.
+ */
+#define DIRTY_RECTS_MAX 8
+
+/* merge when the waste is at most 1/(2^DIRTY_WASTE_SHIFT) of the union... */
+#define DIRTY_WASTE_SHIFT 2
+/* ...or when the waste is negligible anyway (pixels) */
+#define DIRTY_WASTE_MIN (32*32)
+
+typedef struct dirty_rect
+{
+	DWORD left;
+	DWORD top;
+	DWORD right;
+	DWORD bottom;
+} dirty_rect_t;
+
+typedef struct dirty_list
+{
+	DWORD cnt;
+	DWORD damage; /* sum of all added areas (in pixels) */
+	dirty_rect_t rects[DIRTY_RECTS_MAX];
+} dirty_list_t;
+
+static inline DWORD dirty_area(dirty_rect_t *r)
+{
+	return (r->right - r->left) * (r->bottom - r->top);
+}
+
+static inline void dirty_union(dirty_rect_t *a, dirty_rect_t *b, dirty_rect_t *out)
+{
+	out->left   = a->left   < b->left   ? a->left   : b->left;
+	out->top    = a->top    < b->top    ? a->top    : b->top;
+	out->right  = a->right  > b->right  ? a->right  : b->right;
+	out->bottom = a->bottom > b->bottom ? a->bottom : b->bottom;
+}
+
+/* area of union box not covered by any of A and B */
+static DWORD dirty_waste(dirty_rect_t *a, dirty_rect_t *b, DWORD *union_area)
+{
+	dirty_rect_t u;
+	DWORD covered = dirty_area(a) + dirty_area(b);
+	DWORD il = a->left   > b->left   ? a->left   : b->left;
+	DWORD it = a->top    > b->top    ? a->top    : b->top;
+	DWORD ir = a->right  < b->right  ? a->right  : b->right;
+	DWORD ib = a->bottom < b->bottom ? a->bottom : b->bottom;
+
+	if(il < ir && it < ib)
+	{
+		covered -= (ir - il) * (ib - it);
+	}
+
+	dirty_union(a, b, &u);
+	*union_area = dirty_area(&u);
+
+	return *union_area - covered;
+}
+
+static inline void dirty_reset(dirty_list_t *dl)
+{
+	dl->cnt = 0;
+	dl->damage = 0;
+}
+
+static inline void dirty_remove(dirty_list_t *dl, DWORD index)
+{
+	dl->cnt--;
+	if(index != dl->cnt)
+	{
+		dl->rects[index] = dl->rects[dl->cnt];
+	}
+}
+
+static void dirty_add(dirty_list_t *dl, DWORD left, DWORD top, DWORD right, DWORD bottom)
+{
+	dirty_rect_t n;
+	DWORD i;
+
+	if(left >= right || top >= bottom)
+	{
+		return;
+	}
+
+	n.left   = left;
+	n.top    = top;
+	n.right  = right;
+	n.bottom = bottom;
+	dl->damage += dirty_area(&n);
+
+	for(;;)
+	{
+		DWORD best = DIRTY_RECTS_MAX;
+		DWORD best_waste = ~0UL;
+
+		for(i = 0; i < dl->cnt; i++)
+		{
+			DWORD ua;
+			DWORD waste = dirty_waste(&n, &dl->rects[i], &ua);
+
+			if(waste <= DIRTY_WASTE_MIN || (waste << DIRTY_WASTE_SHIFT) <= ua)
+			{
+				break;
+			}
+
+			if(waste < best_waste)
+			{
+				best_waste = waste;
+				best = i;
+			}
+		}
+
+		if(i == dl->cnt)
+		{
+			if(dl->cnt < DIRTY_RECTS_MAX)
+			{
+				dl->rects[dl->cnt++] = n;
+				return;
+			}
+			/* list is full, merge with the cheapest one */
+			i = best;
+		}
+
+		/* merged box can now overlap some other rectangle, so try again */
+		dirty_union(&n, &dl->rects[i], &n);
+		dirty_remove(dl, i);
+	}
+}
+
+/* sum of areas which will be really blitted */
+static DWORD dirty_pixels(dirty_list_t *dl)
+{
+	DWORD i;
+	DWORD px = 0;
+
+	for(i = 0; i < dl->cnt; i++)
+	{
+		px += dirty_area(&dl->rects[i]);
+	}
+
+	return px;
+}
+
+#endif /* __VXD_RECT_H__INCLUDED__ */
@@ -47,6 +47,8 @@ THE SOFTWARE.
 
 #include "vxd_color.h"
 
+#include "vxd_rect.h"
+
 /*
  * consts
  */
@@ -86,6 +88,8 @@ void *ctlbuf = NULL;
 
 DWORD async_mobs = 1;
 DWORD hw_cursor  = 0;
+DWORD hw_cursor_alpha = 1;
+DWORD otable_dynamic = 0;
 
 ULONG cb_sem = 0;
 ULONG mem_sem = 0;
@@ -103,6 +107,7 @@ BOOL mouse_get_rect(DWORD *ptr_left, DWORD *ptr_top,
  */
 static char SVGA_conf_path[] = "Software\\vmdisp9x\\svga";
 static char SVGA_conf_hw_cursor[]  = "HWCursor";
+static char SVGA_conf_alpha_cursor[] = "AlphaCursor";
 /*	^ recovered */
 static char SVGA_conf_vram_limit[] = "VRAMLimit";
 static char SVGA_conf_rgb565bug[]  = "RGB565bug";
@@ -113,11 +118,26 @@ static char SVGA_conf_disable_multisample[] = "NoMultisample";
 static char SVGA_conf_reg_multisample[] = "RegMultisample";
 static char SVGA_conf_async_mobs[] = "AsyncMOBs";
 static char SVGA_conf_no_scr_accel[] = "NoScreenAccel";
+static char SVGA_conf_otable_dynamic[] = "DynamicOTables";
+static char SVGA_conf_mtrr[] = "MTRR";
 
 static char SVGA_vxd_name[]        = "vmwsmini.vxd";
 
 svga_saved_state_t svga_saved_state = {FALSE};
 
+/* mode currently programmed to HW by SVGA_setmode_phy */
+static BOOL  svga_phy_valid  = FALSE;
+static DWORD svga_phy_width  = 0;
+static DWORD svga_phy_height = 0;
+
+static SVGA_devcap_cache_t *devcap_cache = NULL;
+
+/* caps really reported by device in last snapshot */
+static BYTE devcap_present[SVGA_DEVCAP_CACHE_MAX];
+static BOOL SVGA_surface_dirty_rects(SVGA_dirty_rects_t *dr);
+static void SVGA_DevCap_snapshot();
+static void SVGA_DevCap_invalidate();
+
 /**
  * Notify virtual HW that is some work to do
  **/
@@ -208,6 +228,18 @@ SVGA_DB_surface_t *SVGA_GetSurfaceInfo(DWORD sid)
 	return NULL;
 }
 
+SVGA_DB_region_t *SVGA_GetRegionInfo(DWORD region_id)
+{
+	if(svga_db != NULL && region_id > 0 && region_id <= svga_db->regions_cnt)
+	{
+		SVGA_DB_region_t *dbr = &(svga_db->regions[region_id-1]);
+		if(dbr->pid != 0 && dbr->info.region_id == region_id)
+			return dbr;
+	}
+	
+	return NULL;
+}
+
 SVGA_DB_t *SVGA_DB_setup()
 {
 	return svga_db;
@@ -362,6 +394,12 @@ BOOL SVGA_vxdcmd(DWORD cmd, DWORD arg)
 		case SVGA_CMD_CLEANUP:
 			SVGA_ProcessCleanup(arg);
 			return TRUE;
+		case SVGA_CMD_REGION_RESTORE:
+			return SVGA_region_restore(arg);
+		case SVGA_CMD_OTABLE_GROW:
+			return SVGA_OTable_grow(arg >> 24, arg & 0xFFFFFFUL);
+		case SVGA_CMD_DIRTY_RECTS:
+			return SVGA_surface_dirty_rects((SVGA_dirty_rects_t*)arg);
 	}
 	
 	return FALSE;
@@ -414,6 +452,7 @@ BOOL SVGA_init_hw()
 	DWORD conf_rgb565bug = 1;
 	DWORD conf_cb = 1;
 	DWORD conf_hw_version = SVGA_VERSION_2;
+	DWORD conf_mtrr = 1;
 #if 0
 	uint8 irq = 0;
 #endif
@@ -436,7 +475,10 @@ BOOL SVGA_init_hw()
 
 	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_async_mobs,  &async_mobs);
 	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_hw_cursor,   &hw_cursor);
+	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_alpha_cursor, &hw_cursor_alpha);
 	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_no_scr_accel, &disable_screen_accel);
+	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_otable_dynamic, &otable_dynamic);
+	RegReadConf(HKEY_LOCAL_MACHINE, SVGA_conf_path, SVGA_conf_mtrr, &conf_mtrr);
 
  	if(async_mobs < 1)
  		async_mobs = 1;
@@ -495,6 +537,9 @@ BOOL SVGA_init_hw()
 		dbg_printf(dbg_siz, sizeof(gSVGA), sizeof(uint8 FARP *));
 		
 		SVGA_write_driver_id();
+		
+		/* select blit kernels */
+		color_init();
 
 #if 0
 		irq = SVGA_Install_IRQ();
@@ -560,6 +605,10 @@ BOOL SVGA_init_hw()
 
 		SVGA_DB_alloc();
 		
+		/* shared devcaps snapshot */
+		devcap_cache = (SVGA_devcap_cache_t*)_PageAllocate(RoundToPages(sizeof(SVGA_devcap_cache_t)), PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED | PAGEZEROINIT);
+		hda->devcaps = devcap_cache;
+		
 		/* allocate buffer for enable and disable CB */
 		ctlbuf = SVGA_CMB_alloc_size(64);
 		
@@ -589,6 +638,11 @@ BOOL SVGA_init_hw()
 		hda->vram_bar_size = gSVGA.vramSize;
 		hda->vram_pm16 = fb_pm16;
 		
+		if(conf_mtrr)
+		{
+			FBHDA_write_combine(gSVGA.fbPhy, gSVGA.vramSize);
+		}
+		
  		memcpy(hda->vxdname, SVGA_vxd_name, sizeof(SVGA_vxd_name));
 		
 		hda->flags |= FB_ACCEL_VMSVGA;
@@ -844,7 +898,8 @@ static void SVGA_setmode_phy(DWORD w, DWORD h, DWORD bpp)
 	/* setting screen by fifo, this method is required in VB 6.1 */
 	if(SVGA_hasAccelScreen(FALSE))
 	{
-		SVGA_defineScreen(w, h, bpp, 0);
+		/* screen is always 32 bpp, lower depths are converted from system surface */
+		SVGA_defineScreen(w, h, 32, 0);
 
 		/* reenable fifo */
 		SVGA_Enable();
@@ -859,6 +914,28 @@ static void SVGA_setmode_phy(DWORD w, DWORD h, DWORD bpp)
 	
 	SVGA_Sync();
 	SVGA_Flush_CB();
+	
+	svga_phy_valid  = TRUE;
+	svga_phy_width  = w;
+	svga_phy_height = h;
+}
+
+/*
+ * Physical screen is always 32 bpp and depends only on resolution,
+ * so when only bpp (and so system surface format) changes, we can
+ * skip the whole device reset.
+ */
+static BOOL SVGA_setmode_fast(DWORD w, DWORD h)
+{
+	if(svga_phy_valid && svga_saved_state.enabled)
+	{
+		if(svga_phy_width == w && svga_phy_height == h)
+		{
+			return TRUE;
+		}
+	}
+	
+	return FALSE;
 }
 
 /* clear both physical screen and system surface */
@@ -866,12 +943,12 @@ void SVGA_clear()
 {
 	if(hda->system_surface)
 	{
-		memset((BYTE*)hda->vram_pm32 + hda->system_surface, 0, hda->height*hda->pitch);
-		memset(hda->vram_pm32, 0, SVGA_pitch(hda->width, 32)*hda->height);
+		fb_memset((BYTE*)hda->vram_pm32 + hda->system_surface, 0, hda->height*hda->pitch);
+		fb_memset(hda->vram_pm32, 0, SVGA_pitch(hda->width, 32)*hda->height);
 	}
 	else
 	{
-		memset(hda->vram_pm32, 0, hda->height*hda->pitch);
+		fb_memset(hda->vram_pm32, 0, hda->height*hda->pitch);
 	}
 }
 
@@ -882,6 +959,7 @@ void SVGA_clear()
 BOOL SVGA_setmode(DWORD w, DWORD h, DWORD bpp)
 {
 	BOOL has3D = FALSE;
+	BOOL fast;
 	DWORD w_fix = SVGA_fix_width(w, bpp);
 
 	if(!SVGA_validmode(w_fix, h, bpp))
@@ -889,6 +967,8 @@ BOOL SVGA_setmode(DWORD w, DWORD h, DWORD bpp)
 		return FALSE;
 	}
 	
+	fast = SVGA_setmode_fast(w_fix, h);
+	
 	svga_saved_state.width = w_fix;
 	svga_saved_state.height = h;
 	svga_saved_state.bpp = bpp;
@@ -911,14 +991,28 @@ BOOL SVGA_setmode(DWORD w, DWORD h, DWORD bpp)
 	mouse_invalidate();
 	FBHDA_access_begin(0);
 	
-	SVGA_setmode_phy(w_fix, h, bpp);
-
-	if(gpu_allocated)
+	if(fast)
 	{
-		has3D = SVGA3D_Init();
+		/* GPU wasn't reset, 3D state and caps are still valid */
+		dbg_printf("SVGA_setmode: fast path %ld x %ld x %ld\n", w_fix, h, bpp);
+		has3D = (hda->flags & FB_ACCEL_VMSVGA3D) ? TRUE : FALSE;
 	}
+	else
+	{
+		SVGA_DevCap_invalidate();
+		SVGA_setmode_phy(w_fix, h, bpp);
 
-	hda->flags &= ~((DWORD)FB_SUPPORT_FLIPING);
+		if(gpu_allocated)
+		{
+			has3D = SVGA3D_Init();
+			if(has3D)
+			{
+				SVGA_DevCap_snapshot();
+			}
+		}
+	}
+
+	hda->flags &= ~((DWORD)(FB_SUPPORT_FLIPING | FB_SUPPORT_TRIPLE));
 	hda->flags &= ~((DWORD)FB_ACCEL_VMSVGA10_ST);
 
 /*
@@ -961,7 +1055,7 @@ BOOL SVGA_setmode(DWORD w, DWORD h, DWORD bpp)
 
 	if(hda->system_surface > 0)
 	{
-		hda->flags |= FB_SUPPORT_FLIPING;
+		hda->flags |= FB_SUPPORT_FLIPING | FB_SUPPORT_TRIPLE;
 		if(SVGA_hasAccelScreen(TRUE))
 		{
 			SVGA_DefineGMRFB();
@@ -977,6 +1071,8 @@ BOOL SVGA_setmode(DWORD w, DWORD h, DWORD bpp)
 
 	fb_lock_cnt = 0; // reset lock counters
 
+	FBHDA_vblank_measure();
+
   return TRUE;
 }
 
@@ -1042,6 +1138,11 @@ DWORD SVGA_FixDevCap(DWORD cap_id, DWORD cap_val)
  **/
 DWORD SVGA_GetDevCap(DWORD search_id)
 {
+	if(devcap_cache != NULL && devcap_cache->valid && search_id < devcap_cache->count)
+	{
+		return devcap_cache->caps[search_id];
+	}
+	
 	if (gSVGA.capabilities & SVGA_CAP_GBOBJECTS)
 	{
 		/* new way to read device CAPS */
@@ -1077,6 +1178,84 @@ DWORD SVGA_GetDevCap(DWORD search_id)
 	return 0;
 }
 
+/**
+ * Read all caps at once to shared cache
+ *
+ **/
+static void SVGA_DevCap_snapshot()
+{
+	DWORD i;
+	DWORD cnt = SVGA3D_DEVCAP_MAX;
+	
+	if(devcap_cache == NULL)
+		return;
+	
+	devcap_cache->valid = 0;
+	
+	if(cnt > SVGA_DEVCAP_CACHE_MAX)
+	{
+		cnt = SVGA_DEVCAP_CACHE_MAX;
+	}
+	
+	memset(devcap_cache->caps, 0, sizeof(devcap_cache->caps));
+	memset(devcap_present, 0, sizeof(devcap_present));
+	
+	if(gSVGA.capabilities & SVGA_CAP_GBOBJECTS)
+	{
+		for(i = 0; i < cnt; i++)
+		{
+			SVGA_WriteReg(SVGA_REG_DEV_CAP, i);
+			devcap_cache->caps[i] = SVGA_ReadReg(SVGA_REG_DEV_CAP);
+			devcap_present[i] = 1;
+		}
+	}
+	else
+	{
+		/* one walk thru FIFO records */
+		SVGA3dCapsRecord *pCaps = (SVGA3dCapsRecord *)&(gSVGA.fifoMem[SVGA_FIFO_3D_CAPS]);  
+		while(pCaps->header.length != 0)
+		{
+			if(pCaps->header.type == SVGA3DCAPS_RECORD_DEVCAPS)
+			{
+				DWORD datalen = (pCaps->header.length - 2)/2;
+				SVGA3dCapPair *pData = (SVGA3dCapPair *)(&pCaps->data);
+				
+				for(i = 0; i < datalen; i++)
+				{
+					if(pData[i][0] < cnt)
+					{
+						devcap_cache->caps[pData[i][0]] = pData[i][1];
+						devcap_present[pData[i][0]] = 1;
+					}
+				}
+			}
+			pCaps = (SVGA3dCapsRecord *)((DWORD *)pCaps + pCaps->header.length);
+		}
+	}
+	
+	/* fixes may read other caps, cache isn't valid yet so they go to HW,
+	   caps missing in FIFO records stay 0 as SVGA_GetDevCap returns them */
+	for(i = 0; i < cnt; i++)
+	{
+		if(devcap_present[i])
+		{
+			devcap_cache->caps[i] = SVGA_FixDevCap(i, devcap_cache->caps[i]);
+		}
+	}
+	
+	devcap_cache->count = cnt;
+	devcap_cache->generation++;
+	devcap_cache->valid = 1;
+}
+
+static void SVGA_DevCap_invalidate()
+{
+	if(devcap_cache != NULL)
+	{
+		devcap_cache->valid = 0;
+	}
+}
+
 DWORD SVGA_query(DWORD type, DWORD index)
 {
 	switch(type)
@@ -1122,11 +1301,13 @@ void SVGA_HW_disable()
 {
 	dbg_printf("SVGA_HW_disable()\n");
 	
+	SVGA_DevCap_invalidate();
 	SVGA_CB_stop();
 	
 	SVGA_Disable();
 	
 	svga_saved_state.enabled = FALSE;
+	svga_phy_valid = FALSE;
 }
 
 BOOL SVGA_valid()
@@ -1134,6 +1315,16 @@ BOOL SVGA_valid()
 	return SVGA_is_valid;
 }
 
+BOOL FBHDA_swap_ready()
+{
+	return !SVGA_CMB_update_pending();
+}
+
+BOOL FBHDA_swap_queued(DWORD offset)
+{
+	return FBHDA_swap(offset);
+}
+
 BOOL FBHDA_swap(DWORD offset)
 {
 	BOOL rc = FALSE;
@@ -1144,6 +1335,7 @@ BOOL FBHDA_swap(DWORD offset)
 		if(offset >= hda->system_surface && hda->bpp >= 8)
 		{
 			hda->surface = offset;
+			FBHDA_present_mark();
 			return TRUE;
 		}
 		return FALSE;
@@ -1164,45 +1356,179 @@ BOOL FBHDA_swap(DWORD offset)
 		FBHDA_access_end(0);
 	}
 
+	if(rc)
+	{
+		FBHDA_present_mark();
+	}
+
 	return rc;
 }
 
-static DWORD rect_left;
-static DWORD rect_top;
-static DWORD rect_right;
-static DWORD rect_bottom;
+static dirty_list_t dirty;
 
 static inline void update_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
 {
-	if(left < rect_left)
-		rect_left = left;
+	if(right > hda->width)
+		right = hda->width;
 
-	if(top < rect_top)
-		rect_top = top;
+	if(bottom > hda->height)
+		bottom = hda->height;
 
-	if(right > rect_right)
+	dirty_add(&dirty, left, top, right, bottom);
+}
+
+/*
+ * GPU surface areas waiting to be read back. Submitter could announce dirty
+ * rects by SVGA_CMD_DIRTY_RECTS before SVGA_CB_DIRTY_SURFACE submit, without
+ * them the whole screen is read back. Announced rects are kept per thread,
+ * so they are consumed only by submit of the same thread. Lists are modified
+ * from submit (under cb_sem), so guard them by critical section instead of
+ * hda_sem.
+ */
+#define READBACK_OWNERS_MAX 4
+
+typedef struct _readback_pending_t
+{
+	void *thread;
+	dirty_list_t list;
+} readback_pending_t;
+
+static readback_pending_t readback_pending[READBACK_OWNERS_MAX];
+static DWORD readback_pending_next = 0;
+static dirty_list_t readback;
+static BOOL readback_full = FALSE;
+
+/* find slot of thread, when create is set and slot isn't exists, recycle the oldest one */
+static readback_pending_t *readback_pending_get(void *thread, BOOL create)
+{
+	DWORD i;
+	readback_pending_t *p;
+
+	for(i = 0; i < READBACK_OWNERS_MAX; i++)
 	{
-		rect_right = right;
-		if(rect_right > hda->width)
+		if(readback_pending[i].thread == thread)
 		{
-			rect_right = hda->width;
+			return &readback_pending[i];
 		}
 	}
 
-	if(bottom > rect_bottom)
+	if(!create)
+		return NULL;
+
+	/* owner of recycled slot will read back whole screen */
+	p = &readback_pending[readback_pending_next];
+	readback_pending_next = (readback_pending_next + 1) % READBACK_OWNERS_MAX;
+
+	p->thread = thread;
+	dirty_reset(&p->list);
+
+	return p;
+}
+
+static BOOL SVGA_surface_dirty_rects(SVGA_dirty_rects_t *dr)
+{
+	dirty_rect_t rects[SVGA_DIRTY_RECTS_MAX];
+	DWORD cnt;
+	DWORD i;
+	void *thread;
+	readback_pending_t *p;
+
+	if(dr == NULL || dr->cb < sizeof(SVGA_dirty_rects_t))
+		return FALSE;
+
+	/* copy user data out of critical section */
+	cnt = dr->count;
+	if(cnt > SVGA_DIRTY_RECTS_MAX)
+	{
+		cnt = 1;
+		rects[0].left   = 0;
+		rects[0].top    = 0;
+		rects[0].right  = hda->width;
+		rects[0].bottom = hda->height;
+	}
+	else
+	{
+		for(i = 0; i < cnt; i++)
+		{
+			rects[i].left   = dr->rects[i].left;
+			rects[i].top    = dr->rects[i].top;
+			rects[i].right  = dr->rects[i].right;
+			rects[i].bottom = dr->rects[i].bottom;
+
+			if(rects[i].right > hda->width)
+				rects[i].right = hda->width;
+
+			if(rects[i].bottom > hda->height)
+				rects[i].bottom = hda->height;
+		}
+	}
+
+	thread = Get_Cur_Thread_Handle();
+
+	Begin_Critical_Section(0);
+	p = readback_pending_get(thread, TRUE);
+	for(i = 0; i < cnt; i++)
+	{
+		dirty_add(&p->list, rects[i].left, rects[i].top, rects[i].right, rects[i].bottom);
+	}
+	End_Critical_Section();
+
+	return TRUE;
+}
+
+void SVGA_surface_dirty()
+{
+	DWORD i;
+	void *thread = Get_Cur_Thread_Handle();
+	readback_pending_t *p;
+
+	Begin_Critical_Section(0);
+	p = readback_pending_get(thread, FALSE);
+	if(p == NULL || p->list.cnt == 0)
 	{
-		rect_bottom = bottom;
-		if(rect_bottom > hda->height)
+		readback_full = TRUE;
+	}
+	else
+	{
+		for(i = 0; i < p->list.cnt; i++)
 		{
-			rect_bottom = hda->height;
+			dirty_rect_t *r = &p->list.rects[i];
+			dirty_add(&readback, r->left, r->top, r->right, r->bottom);
 		}
 	}
+
+	if(p != NULL)
+	{
+		dirty_reset(&p->list);
+		p->thread = NULL;
+	}
+	surface_dirty = TRUE;
+	End_Critical_Section();
 }
 
 static inline void check_dirty()
 {
 	if(surface_dirty)
 	{
+		dirty_list_t rb;
+		dirty_rect_t *r;
+		DWORD i;
+		
+		/* readback overwrites saved cursor background */
+		mouse_move_cancel();
+
+		Begin_Critical_Section(0);
+		rb = readback;
+		if(readback_full || rb.cnt == 0)
+		{
+			dirty_reset(&rb);
+			dirty_add(&rb, 0, 0, hda->width, hda->height);
+		}
+		dirty_reset(&readback);
+		readback_full = FALSE;
+		surface_dirty = FALSE;
+		End_Critical_Section();
+
 		switch(hda->bpp)
 		{
 			case 32:
@@ -1214,36 +1540,56 @@ static inline void check_dirty()
 
 					wait_for_cmdbuf();
 
-					gmrblit = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_BLIT_SCREEN_TO_GMRFB, sizeof(SVGAFifoCmdBlitScreenToGMRFB));
-
-					gmrblit->destOrigin.x    = 0;
-					gmrblit->destOrigin.y    = 0;
-					gmrblit->srcRect.left    = 0;
-					gmrblit->srcRect.top     = 0;
-					gmrblit->srcRect.right   = hda->width;
-					gmrblit->srcRect.bottom  = hda->height;
-					gmrblit->srcScreenId = 0;
+					for(i = 0; i < rb.cnt; i++)
+					{
+						r = &rb.rects[i];
+						gmrblit = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_BLIT_SCREEN_TO_GMRFB, sizeof(SVGAFifoCmdBlitScreenToGMRFB));
+
+						gmrblit->destOrigin.x    = r->left;
+						gmrblit->destOrigin.y    = r->top;
+						gmrblit->srcRect.left    = r->left;
+						gmrblit->srcRect.top     = r->top;
+						gmrblit->srcRect.right   = r->right;
+						gmrblit->srcRect.bottom  = r->bottom;
+						gmrblit->srcScreenId = 0;
+					}
 
 					submit_cmdbuf(cmd_offset, SVGA_CB_UPDATE, 0);
 				}
+				else if(rb.cnt == 1 && dirty_area(&rb.rects[0]) == hda->width * hda->height)
+				{
+					fb_memcpy(hda->vram_pm32, ((BYTE*)hda->vram_pm32)+hda->surface, hda->stride);
+				}
 				else
 				{
-					memcpy(hda->vram_pm32, ((BYTE*)hda->vram_pm32)+hda->surface, hda->stride);
+					for(i = 0; i < rb.cnt; i++)
+					{
+						r = &rb.rects[i];
+						blit32(
+							((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
+							hda->vram_pm32, hda->pitch,
+							r->left, r->top,
+							r->right - r->left, r->bottom - r->top
+						);
+					}
 				}
 				break;
 			}
 			case 16:
 			{
-				readback16(
-					hda->vram_pm32, SVGA_pitch(hda->width, 32),
-					((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
-					0, 0, hda->width, hda->height
-				);
+				for(i = 0; i < rb.cnt; i++)
+				{
+					r = &rb.rects[i];
+					readback16(
+						hda->vram_pm32, SVGA_pitch(hda->width, 32),
+						((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
+						r->left, r->top,
+						r->right - r->left, r->bottom - r->top
+					);
+				}
 				break;
 			}
 		} // switch
-
-		surface_dirty = FALSE;
 	}
 }
 
@@ -1279,10 +1625,8 @@ void FBHDA_access_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
 		SVGA_CMB_wait_update();
 		check_dirty();
 		
-		rect_left   = left;
-		rect_top    = top;
-		rect_right  = right;
-		rect_bottom = bottom;
+		dirty_reset(&dirty);
+		update_rect(left, top, right, bottom);
 
 		mouse_erase();
 
@@ -1293,6 +1637,7 @@ void FBHDA_access_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
 	}
 	else
 	{
+		mouse_move_cancel();
 		update_rect(left, top, right, bottom);
 	}
 
@@ -1308,32 +1653,28 @@ void FBHDA_access_begin(DWORD flags)
 	
 	if(flags & (FBHDA_ACCESS_RAW_BUFFERING | FBHDA_ACCESS_MOUSE_MOVE))
 	{
+		DWORD l, t, r, b;
+		
 		Wait_Semaphore(hda_sem, 0);
 		
 //		dbg_printf("FBHDA_access_begin(%ld)\n", flags);
-		
+
 		if(fb_lock_cnt++ == 0)
 		{
 			SVGA_CMB_wait_update();
 			mouse_erase();
 			check_dirty();
 			
-			if(!mouse_get_rect(&rect_left, &rect_top, &rect_right, &rect_bottom))
-			{
-				rect_left   = 0;
-				rect_top    = 0;
-				rect_right  = 0;
-				rect_bottom = 0;
-			}
+			dirty_reset(&dirty);
 		}
 		else
 		{
-			DWORD l, t, r, b;
-			
-			if(mouse_get_rect(&l, &t, &r, &b))
-			{
-				update_rect(l, t, r, b);
-			}
+			mouse_move_cancel();
+		}
+
+		if(mouse_get_rect(&l, &t, &r, &b))
+		{
+			update_rect(l, t, r, b);
 		}
 		
 		Signal_Semaphore(hda_sem);
@@ -1357,6 +1698,7 @@ void FBHDA_access_end(DWORD flags)
 
 	if(flags & FBHDA_ACCESS_SURFACE_DIRTY)
 	{
+		readback_full = TRUE;
 		surface_dirty = TRUE;
 	}
 
@@ -1372,18 +1714,16 @@ void FBHDA_access_end(DWORD flags)
 
 	if(--fb_lock_cnt <= 0)
 	{
-		DWORD w, h;
+		DWORD i;
+		dirty_rect_t *r;
 		BOOL need_refresh = ((hda->bpp == 32) && (hda->system_surface == 0));
 		
 		fb_lock_cnt = 0;
 		
-		w = rect_right - rect_left;
-		h = rect_bottom - rect_top;
-		
-/*		dbg_printf("FBHDA_access_end(%ld %ld %ld %ld)\n", 
-			rect_left, rect_top, rect_right, rect_bottom);*/
+/*		dbg_printf("FBHDA_access_end(%ld rects, %ld damaged)\n", 
+			dirty.cnt, dirty.damage);*/
 
-		if(w > 0 && h > 0)
+		if(dirty.cnt > 0)
 		{
 			check_dirty();
 			mouse_blit();
@@ -1400,47 +1740,64 @@ void FBHDA_access_end(DWORD flags)
 
 							wait_for_cmdbuf();
 
-							gmrblit = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_BLIT_GMRFB_TO_SCREEN, sizeof(SVGAFifoCmdBlitGMRFBToScreen));
+							for(i = 0; i < dirty.cnt; i++)
+							{
+								r = &dirty.rects[i];
+								gmrblit = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_BLIT_GMRFB_TO_SCREEN, sizeof(SVGAFifoCmdBlitGMRFBToScreen));
 
-							gmrblit->srcOrigin.x      = rect_left;
-							gmrblit->srcOrigin.y      = rect_top;
-							gmrblit->destRect.left    = rect_left;
-							gmrblit->destRect.top     = rect_top;
-							gmrblit->destRect.right   = rect_right;
-							gmrblit->destRect.bottom  = rect_bottom;
+								gmrblit->srcOrigin.x      = r->left;
+								gmrblit->srcOrigin.y      = r->top;
+								gmrblit->destRect.left    = r->left;
+								gmrblit->destRect.top     = r->top;
+								gmrblit->destRect.right   = r->right;
+								gmrblit->destRect.bottom  = r->bottom;
 
-							gmrblit->destScreenId = 0;
+								gmrblit->destScreenId = 0;
+							}
 
 							submit_cmdbuf(cmd_offset, SVGA_CB_UPDATE, 0);
 						}
 						else
 						{
-							blit32(
-								((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
-								hda->vram_pm32, hda->pitch,
-								rect_left, rect_top,
-								rect_right - rect_left, rect_bottom - rect_top
-							);
+							for(i = 0; i < dirty.cnt; i++)
+							{
+								r = &dirty.rects[i];
+								blit32(
+									((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
+									hda->vram_pm32, hda->pitch,
+									r->left, r->top,
+									r->right - r->left, r->bottom - r->top
+								);
+							}
 							need_refresh = TRUE;
 						}
 						break;
 					}
 					case 16:
-						blit16(
-							((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
-							hda->vram_pm32,  SVGA_pitch(hda->width, 32),
-							rect_left, rect_top,
-							rect_right - rect_left, rect_bottom - rect_top
-						);
+						for(i = 0; i < dirty.cnt; i++)
+						{
+							r = &dirty.rects[i];
+							blit16(
+								((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
+								hda->vram_pm32,  SVGA_pitch(hda->width, 32),
+								r->left, r->top,
+								r->right - r->left, r->bottom - r->top
+							);
+						}
 						need_refresh = TRUE;
 						break;
 					case 8:
-						blit8(
-							((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
-							hda->vram_pm32,  SVGA_pitch(hda->width, 32),
-							rect_left, rect_top,
-							rect_right - rect_left, rect_bottom - rect_top
-						);
+						for(i = 0; i < dirty.cnt; i++)
+						{
+							r = &dirty.rects[i];
+							blit8(
+								((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch,
+								hda->vram_pm32,  SVGA_pitch(hda->width, 32),
+								r->left, r->top,
+								r->right - r->left, r->bottom - r->top,
+								hda->palette_update
+							);
+						}
 						need_refresh = TRUE;
 						break;
 				} // switch
@@ -1453,19 +1810,30 @@ void FBHDA_access_end(DWORD flags)
 	
 		  	wait_for_cmdbuf();
 	
-		  	cmd_update = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_UPDATE, sizeof(SVGAFifoCmdUpdate));
-		  	cmd_update->x = rect_left;
-		  	cmd_update->y = rect_top;
-		  	cmd_update->width  = rect_right - rect_left;
-		  	cmd_update->height = rect_bottom - rect_top;
+				for(i = 0; i < dirty.cnt; i++)
+				{
+					r = &dirty.rects[i];
+					cmd_update = SVGA_cmd_ptr(cmdbuf, &cmd_offset, SVGA_CMD_UPDATE, sizeof(SVGAFifoCmdUpdate));
+					cmd_update->x = r->left;
+					cmd_update->y = r->top;
+					cmd_update->width  = r->right - r->left;
+					cmd_update->height = r->bottom - r->top;
+				}
 	
 				submit_cmdbuf(cmd_offset, SVGA_CB_UPDATE, 0);
 		  }
+
+			hda->dirty_damaged += dirty.damage;
+			hda->dirty_blitted += dirty_pixels(&dirty);
 		}
 		else
 		{
 			mouse_blit(); /* in this case is mouse unvisible, but we need still switch visibility state */
-		} // w == 0 && h == 0
+		} // dirty.cnt == 0
+		
+		Signal_Semaphore(hda_sem);
+		FBHDA_swap_flush(FALSE);
+		return;
 	} // fb_lock_cnt == 0
 	
 	Signal_Semaphore(hda_sem);
@@ -1488,6 +1856,45 @@ void FBHDA_palette_set(unsigned char index, DWORD rgb)
   hda->palette_update++;
 }
 
+void FBHDA_palette_set_range(DWORD start, DWORD count, DWORD *colors)
+{
+	DWORD i;
+
+	if(start >= 256)
+		return;
+
+	if(start + count > 256)
+		count = 256 - start;
+
+	if(hda->system_surface > 0)
+	{
+		for(i = 0; i < count; i++)
+		{
+			palette_emulation[start + i] = colors[i] & 0x00FFFFFFUL;
+		}
+		hda->palette_update++;
+
+		/* one redraw for whole range */
+		if(hda->bpp == 8)
+		{
+			FBHDA_access_begin(0);
+			FBHDA_access_end(0);
+		}
+	}
+	else
+	{
+		for(i = 0; i < count; i++)
+		{
+			UINT sIndex = SVGA_PALETTE_BASE + (start + i)*3;
+
+			SVGA_WriteReg(sIndex+0, (colors[i] >> 16) & 0xFF);
+			SVGA_WriteReg(sIndex+1, (colors[i] >>  8) & 0xFF);
+			SVGA_WriteReg(sIndex+2,  colors[i]        & 0xFF);
+		}
+		hda->palette_update++;
+	}
+}
+
 DWORD FBHDA_palette_get(unsigned char index)
 {
 	if(hda->system_surface > 0)
@@ -1529,6 +1936,7 @@ DWORD FBHDA_overlay_setup(DWORD overlay, DWORD width, DWORD height, DWORD bpp)
 		if(!svga_saved_state.enabled)
 		{
 			SVGA_Disable();
+			svga_phy_valid = FALSE;
 		}
 		else
 		{
@@ -1567,7 +1975,7 @@ DWORD FBHDA_overlay_setup(DWORD overlay, DWORD width, DWORD height, DWORD bpp)
 
 				/* clear screen */
 				FBHDA_overlay_lock(0, 0, width_fix, height);
-				memset(hda->overlays[overlay].ptr, 0, stride);
+				fb_memset(hda->overlays[overlay].ptr, 0, stride);
 				FBHDA_overlay_unlock(0);
 
 				return pitch;
@@ -46,27 +46,36 @@ void SVGA_AllProcessCleanup();
 
 /* mouse */
 BOOL SVGA_mouse_hw();
-BOOL SVGA_mouse_load();
+BOOL SVGA_mouse_load(DWORD serial);
 void SVGA_mouse_move(int x, int y);
 void SVGA_mouse_show();
 void SVGA_mouse_hide(BOOL invalidate);
 
 /* memory */
 void set_fragmantation_limit();
+SVGA_DB_region_t *SVGA_GetRegionInfo(DWORD region_id);
+BOOL SVGA_region_evict(DWORD pages);
+BOOL SVGA_region_restore(DWORD region_id);
+void SVGA_region_lru_restore();
 void SVGA_OTable_load();
 void SVGA_OTable_alloc(BOOL screentargets);
 void SVGA_OTable_unload();
+BOOL SVGA_OTable_grow(DWORD type, DWORD entries);
+BOOL SVGA_CMB_scan(DWORD *cmb, DWORD cmb_size);
+extern DWORD otable_dynamic;
 void cache_init();
 void cache_enable(BOOL enabled);
 
 /* CB */
 extern DWORD async_mobs;
+void SVGA_surface_dirty();
 DWORD *SVGA_CMB_alloc_size(DWORD datasize);
 void SVGA_CMB_free(DWORD *cmb);
 void SVGA_CB_start();
 void SVGA_CB_stop();
 void SVGA_CB_restart();
 void SVGA_CMB_wait_update();
+BOOL SVGA_CMB_update_pending();
 
 void mob_cb_alloc();
 void *mob_cb_get();
@@ -80,8 +80,6 @@ extern BOOL gb_support;
 extern BOOL cb_support;
 extern BOOL cb_context0;
 
-extern BOOL surface_dirty;
-
 //extern DWORD present_fence;
 //extern BOOL ST_FB_invalid;
 
@@ -450,6 +448,31 @@ static void flags_fence_check(DWORD cb_flags)
 	}
 }
 
+static BOOL flags_fence_pending(DWORD cb_flags)
+{
+	DWORD to_check = flags_to_cbq_check(cb_flags);
+	
+	if((to_check & CBQ_PRESENT) != 0 && fence_present != 0)
+	{
+		if(!SVGA_fence_is_passed(fence_present))
+			return TRUE;
+	}
+	
+	if((to_check & CBQ_RENDER) != 0 && fence_render != 0)
+	{
+		if(!SVGA_fence_is_passed(fence_render))
+			return TRUE;
+	}
+	
+	if((to_check & CBQ_UPDATE) != 0 && fence_update != 0)
+	{
+		if(!SVGA_fence_is_passed(fence_update))
+			return TRUE;
+	}
+	
+	return FALSE;
+}
+
 static void flags_fence_insert(DWORD cb_flags, uint32 fence)
 {
 	if((cb_flags & SVGA_CB_PRESENT) != 0)
@@ -505,7 +528,7 @@ void SVGA_CMB_submit(DWORD FBPTR cmb, DWORD cmb_size, SVGA_CMB_status_t FBPTR st
 	
 	if(flags & SVGA_CB_DIRTY_SURFACE)
 	{
-		surface_dirty = TRUE;
+		SVGA_surface_dirty();
 	}
 
 	if(proc_by_cb)
@@ -692,6 +715,11 @@ void SVGA_CMB_submit(DWORD FBPTR cmb, DWORD cmb_size, SVGA_CMB_status_t FBPTR st
 	}
 	
 	Signal_Semaphore(cb_sem);
+	
+	if(flags & SVGA_CB_PRESENT)
+	{
+		FBHDA_present_mark();
+	}
 	//dbg_printf(dbg_cmd_off, cmb[0]);
 }
 
@@ -813,6 +841,18 @@ void SVGA_CB_restart()
 	SVGA_CB_start();
 }
 
+/* non blocking version of SVGA_CMB_wait_update */
+BOOL SVGA_CMB_update_pending()
+{
+	if(cb_support && cb_context0)
+	{
+		CB_queue_check_inline(NULL);
+		return CB_queue_is_flags_set(CBQ_UPDATE);
+	}
+
+	return flags_fence_pending(SVGA_CB_UPDATE);
+}
+
 void SVGA_CMB_wait_update()
 {
 	if(cb_support && cb_context0)
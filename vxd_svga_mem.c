@@ -77,6 +77,40 @@ static SVGA_OT_info_entry_t otable_setup[SVGA_OTABLE_DX_MAX] = {
 
 static SVGA_OT_info_entry_t *otable = NULL;
 
+/* entry sizes for dynamic grow, otable_setup contains maximum sizes */
+static const DWORD otable_entry_size[SVGA_OTABLE_DX_MAX] = {
+	sizeof(SVGAOTableMobEntry),
+	sizeof(SVGAOTableSurfaceEntry),
+	sizeof(SVGAOTableContextEntry),
+	sizeof(SVGAOTableShaderEntry),
+	sizeof(SVGAOTableScreenTargetEntry),
+	sizeof(SVGAOTableDXContextEntry)
+};
+
+/* initial number of MOB and surface entries when OTables are dynamic */
+#define OTABLE_START_ENTRIES 1024
+
+/* regions moved to swappable memory */
+#define LRU_EVICTED_MAX 256
+
+typedef struct _lru_evicted_t
+{
+	DWORD region_id;
+	DWORD size;
+	DWORD mobonly;
+	void *backup;
+} lru_evicted_t;
+
+/* lru_evicted table is protected by mem_sem */
+static lru_evicted_t lru_evicted[LRU_EVICTED_MAX];
+static DWORD lru_evicted_cnt = 0;
+
+/* number of running restores, USED regions must stay in place meanwhile */
+static DWORD lru_restoring = 0;
+
+static BOOL lru_drop(DWORD region_id);
+static BOOL lru_evict_pages(DWORD pages);
+
 #define PHY_CACHE_SIZE (8192 + 1024)
 static DWORD phycache[PHY_CACHE_SIZE];
 static DWORD phycache_starta = 0;
@@ -253,6 +287,13 @@ void SVGA_OTable_alloc(BOOL screentargets)
 		if(otable)
 		{
 			memcpy(otable, &(otable_setup[0]), sizeof(otable_setup));
+			
+			if(otable_dynamic)
+			{
+				/* start small, SVGA_OTable_grow extends them on demand */
+				otable[SVGA_OTABLE_MOB].size = RoundTo4k(OTABLE_START_ENTRIES*otable_entry_size[SVGA_OTABLE_MOB]);
+				otable[SVGA_OTABLE_SURFACE].size = RoundTo4k(OTABLE_START_ENTRIES*otable_entry_size[SVGA_OTABLE_SURFACE]);
+			}
 		}
 	}
 	
@@ -383,6 +424,202 @@ void SVGA_OTable_unload()
 	submit_cmdbuf(cmd_offset, SVGA_CB_SYNC, 0);
 }
 
+/**
+ * Grow object table to hold at least 'entries' items. New table is
+ * allocated, the old one is readback from GPU, copied and replaced by
+ * SET_OTABLE_BASE64 when GPU is idle.
+ *
+ * @return: TRUE if table is large enough
+ *
+ **/
+BOOL SVGA_OTable_grow(DWORD type, DWORD entries)
+{
+	SVGA_OT_info_entry_t *entry;
+	DWORD need;
+	DWORD old_size;
+	DWORD new_size;
+	DWORD new_ppn;
+	DWORD new_pt_depth;
+	void *new_lin;
+	void *ptr;
+	DWORD cmd_offset = 0;
+	SVGA3dCmdReadbackOTable *cmd_readback;
+	SVGA3dCmdSetOTableBase64 *cmd;
+
+	if(otable == NULL || type >= SVGA_OTABLE_DX_MAX)
+		return FALSE;
+
+	entry = &otable[type];
+	need = entries * otable_entry_size[type];
+
+	if(need <= entry->size)
+		return TRUE;
+
+	/* size has to be read again under lock, table could be grown by other process */
+	Wait_Semaphore(mem_sem, 0);
+	old_size = entry->size;
+
+	if(need <= old_size)
+	{
+		Signal_Semaphore(mem_sem);
+		return TRUE;
+	}
+
+	if((entry->flags & SVGA_OT_FLAG_ACTIVE) == 0 || need > otable_setup[type].size)
+	{
+		Signal_Semaphore(mem_sem);
+		return FALSE;
+	}
+
+	new_size = old_size;
+	while(new_size < need)
+	{
+		new_size *= 2;
+	}
+
+	if(new_size > otable_setup[type].size)
+	{
+		new_size = otable_setup[type].size;
+	}
+
+	ptr = (void*)_PageAllocate(RoundToPages(new_size)+PT_count(new_size), PG_VM, ThisVM, 0, 0x0, 0x100000, NULL, PAGEFIXED);
+	if(ptr == NULL)
+	{
+		Signal_Semaphore(mem_sem);
+		return FALSE;
+	}
+
+	PT_build(new_size, ptr, &new_ppn, &new_pt_depth, &new_lin);
+
+	/* wait to idle and let GPU flush the table to guest memory */
+	SVGA_Flush_CB();
+	wait_for_cmdbuf();
+	cmd_readback = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_READBACK_OTABLE, sizeof(SVGA3dCmdReadbackOTable));
+	cmd_readback->type = type;
+	submit_cmdbuf(cmd_offset, SVGA_CB_SYNC, 0);
+
+	memcpy(new_lin, entry->lin, old_size);
+	memset(((BYTE*)new_lin) + old_size, 0, new_size - old_size);
+
+	cmd_offset = 0;
+	wait_for_cmdbuf();
+	cmd = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_SET_OTABLE_BASE64, sizeof(SVGA3dCmdSetOTableBase64));
+	cmd->type = type;
+	cmd->baseAddress.low = new_ppn;
+	cmd->baseAddress.hi  = 0;
+	cmd->sizeInBytes = new_size;
+	cmd->validSizeInBytes = old_size;
+	cmd->ptDepth = new_pt_depth;
+	submit_cmdbuf(cmd_offset, SVGA_CB_SYNC, 0);
+
+	_PageFree(((BYTE*)entry->lin) - PT_count(old_size)*P_SIZE, 0);
+
+	entry->ppn      = new_ppn;
+	entry->lin      = new_lin;
+	entry->size     = new_size;
+	entry->pt_depth = new_pt_depth;
+
+	Signal_Semaphore(mem_sem);
+
+	dbg_printf("OTable %ld grow: %ld -> %ld\n", type, old_size, new_size);
+
+	return TRUE;
+}
+
+/**
+ * LRU could read back and unbind only surfaces (their MOB is known from DB),
+ * so region bound to anything else (context, shader, query, COTable, fence)
+ * is pinned and never evicted. Flag is cleared when region is freed.
+ *
+ **/
+static void region_pin(DWORD region_id)
+{
+	SVGA_DB_region_t *dbr;
+	
+	if(region_id == SVGA3D_INVALID_ID)
+		return;
+	
+	dbr = SVGA_GetRegionInfo(region_id);
+	if(dbr != NULL && (dbr->flags & SVGA_DB_REGION_PINNED) == 0)
+	{
+		Wait_Semaphore(mem_sem, 0);
+		dbr->flags |= SVGA_DB_REGION_PINNED;
+		Signal_Semaphore(mem_sem);
+	}
+}
+
+/**
+ * Walk 3D commands in user command buffer, grow surface table for every
+ * surface defined by it (MOB table is extended same way by region create)
+ * and pin regions bound to non-surface objects.
+ * Scan stops on first non-3D command, because its length is unknown.
+ *
+ * @return: FALSE if table cannot hold some defined surface
+ *
+ **/
+BOOL SVGA_CMB_scan(DWORD *cmb, DWORD cmb_size)
+{
+	BYTE *ptr = (BYTE*)cmb;
+	BYTE *ptr_max = ptr + cmb_size;
+	BOOL rc = TRUE;
+	
+	if(otable == NULL || cmb == NULL)
+		return TRUE;
+	
+	while(ptr + sizeof(SVGA3dCmdHeader) + sizeof(DWORD) <= ptr_max)
+	{
+		SVGA3dCmdHeader *hdr = (SVGA3dCmdHeader*)ptr;
+		DWORD *args = (DWORD*)(hdr+1);
+		DWORD mob_arg = 0; /* index of mobid in command, 0 = none */
+		
+		if(hdr->id < SVGA_3D_CMD_BASE || hdr->id >= SVGA_3D_CMD_MAX)
+			break;
+		
+		if(ptr + sizeof(SVGA3dCmdHeader) + hdr->size > ptr_max)
+			break;
+		
+		switch(hdr->id)
+		{
+			case SVGA_3D_CMD_DEFINE_GB_SURFACE:
+			case SVGA_3D_CMD_DEFINE_GB_SURFACE_V2:
+			case SVGA_3D_CMD_DEFINE_GB_SURFACE_V3:
+			case SVGA_3D_CMD_DEFINE_GB_SURFACE_V4:
+				/* all versions starts with sid */
+				if(otable_dynamic && !SVGA_OTable_grow(SVGA_OTABLE_SURFACE, args[0]+1))
+				{
+					rc = FALSE;
+				}
+				break;
+			case SVGA_3D_CMD_BIND_GB_SHADER:
+			case SVGA_3D_CMD_BIND_GB_CONTEXT:
+			case SVGA_3D_CMD_GB_MOB_FENCE:
+			case SVGA_3D_CMD_DX_BIND_CONTEXT:
+			case SVGA_3D_CMD_DX_BIND_QUERY:
+			case SVGA_3D_CMD_DX_BIND_ALL_QUERY:
+			case SVGA_3D_CMD_DX_BIND_ALL_SHADER:
+			case SVGA_3D_CMD_DX_BIND_STREAMOUTPUT:
+			case SVGA_3D_CMD_DX_SET_COTABLE:
+				mob_arg = 1;
+				break;
+			case SVGA_3D_CMD_END_GB_QUERY:
+			case SVGA_3D_CMD_WAIT_FOR_GB_QUERY:
+			case SVGA_3D_CMD_DX_BIND_SHADER:
+			case SVGA_3D_CMD_DX_MOB_FENCE_64:
+				mob_arg = 2;
+				break;
+		}
+		
+		if(mob_arg > 0 && hdr->size >= (mob_arg+1)*sizeof(DWORD))
+		{
+			region_pin(args[mob_arg]);
+		}
+		
+		ptr += sizeof(SVGA3dCmdHeader) + hdr->size;
+	}
+	
+	return rc;
+}
+
 //#define GMR_CONTIG
 //#define GMR_SYSTEM
 
@@ -423,6 +660,14 @@ BOOL SVGA_region_create(SVGA_region_info_t *rinfo)
 	
 	DWORD pt_pages = PT_count(new_size);
 
+	if(gb_support)
+	{
+		if(!SVGA_OTable_grow(SVGA_OTABLE_MOB, rinfo->region_id+1))
+		{
+			return FALSE;
+		}
+	}
+
 	Wait_Semaphore(mem_sem, 0);
 
 	rinfo->size = new_size;
@@ -441,10 +686,14 @@ BOOL SVGA_region_create(SVGA_region_info_t *rinfo)
 		
 		/* allocate user block */
 		
-		if(!vxd_halloc(nPages+pt_pages, (void**)&maddr))
+		while(!vxd_halloc(nPages+pt_pages, (void**)&maddr))
 		{
-			Signal_Semaphore(mem_sem);
-			return FALSE;
+			/* out of GPU memory, try to move some cold regions away */
+			if(!lru_evict_pages(nPages+pt_pages))
+			{
+				Signal_Semaphore(mem_sem);
+				return FALSE;
+			}
 		}
 
 		cachePPN(maddr, nPages+pt_pages);
@@ -613,14 +862,31 @@ BOOL SVGA_region_create(SVGA_region_info_t *rinfo)
 }
 
 /**
- * Free data allocated by SVGA_region_create
+ * Free region, caller must hold mem_sem
  *
  **/
-void SVGA_region_free(SVGA_region_info_t *rinfo)
+static void region_free_locked(SVGA_region_info_t *rinfo, SVGA_DB_region_t *dbr)
 {
-	BYTE *free_ptr = (BYTE*)rinfo->address;
-
-	Wait_Semaphore(mem_sem, 0);
+	BYTE *free_ptr;
+	
+	if(lru_drop(rinfo->region_id))
+	{
+		/* region is evicted, GMR and MOB are already released */
+		if(dbr != NULL)
+		{
+			dbr->flags &= ~SVGA_DB_REGION_EVICTED;
+		}
+		
+		rinfo->address        = NULL;
+		rinfo->region_address = NULL;
+		rinfo->mob_address    = NULL;
+		rinfo->region_ppn     = 0;
+		rinfo->mob_ppn        = 0;
+		rinfo->mob_pt_depth   = 0;
+		return;
+	}
+	
+	free_ptr = (BYTE*)rinfo->address;
 
 	svga_db->stat_regions_usage -= rinfo->size;
 	//dbg_printf("Less memory usage: %ld (-%ld)\n", svga_db->stat_regions_usage, rinfo->size);
@@ -671,7 +937,6 @@ void SVGA_region_free(SVGA_region_info_t *rinfo)
 	}
 		
 	//dbg_printf(dbg_pagefree_end, rinfo->region_id, rinfo->size, saved_in_cache);
-	Signal_Semaphore(mem_sem);
 	
 	rinfo->address        = NULL;
 	rinfo->region_address = NULL;
@@ -680,3 +945,383 @@ void SVGA_region_free(SVGA_region_info_t *rinfo)
 	rinfo->mob_ppn        = 0;
 	rinfo->mob_pt_depth   = 0;
 }
+
+/**
+ * Free data allocated by SVGA_region_create
+ *
+ **/
+void SVGA_region_free(SVGA_region_info_t *rinfo)
+{
+	SVGA_DB_region_t *dbr = SVGA_GetRegionInfo(rinfo->region_id);
+	
+	if(dbr != NULL && rinfo != &dbr->info && (dbr->flags & SVGA_DB_REGION_EVICTABLE) != 0)
+	{
+		/* region may be moved by eviction, so user copy could be outdated */
+		rinfo = &dbr->info;
+	}
+
+	Wait_Semaphore(mem_sem, 0);
+	region_free_locked(rinfo, dbr);
+	if(dbr != NULL)
+	{
+		dbr->flags &= ~SVGA_DB_REGION_PINNED;
+	}
+	Signal_Semaphore(mem_sem);
+}
+
+/**
+ * LRU eviction of user regions
+ *
+ * Works only with regions which user space marks as SVGA_DB_REGION_EVICTABLE
+ * and which back only surfaces (see region_pin).
+ * Age is approximated by clock algorithm: region with USED flag is never
+ * victim, it only loses the flag in lru_age() and could be evicted by next
+ * eviction request when user space doesn't mark it again. Cold regions are
+ * evicted from oldest fence, when their fence is already passed.
+ *
+ * Caller must hold mem_sem.
+ *
+ **/
+static SVGA_DB_region_t *lru_victim()
+{
+	DWORD i;
+	SVGA_DB_region_t *victim = NULL;
+	
+	for(i = 0; i < svga_db->regions_cnt; i++)
+	{
+		SVGA_DB_region_t *dbr = &svga_db->regions[i];
+		
+		if(dbr->pid == 0 || dbr->info.address == NULL)
+			continue;
+		
+		if((dbr->flags & (SVGA_DB_REGION_EVICTABLE | SVGA_DB_REGION_EVICTED | SVGA_DB_REGION_USED | SVGA_DB_REGION_PINNED)) != SVGA_DB_REGION_EVICTABLE)
+			continue;
+		
+		if(!SVGA_fence_is_passed(dbr->last_fence))
+			continue;
+		
+		if(victim == NULL || dbr->last_fence < victim->last_fence)
+		{
+			victim = dbr;
+		}
+	}
+	
+	return victim;
+}
+
+/**
+ * Second chance: clear USED flag on all evictable regions and stamp them
+ * by last issued fence. Not done while restore is running, because restored
+ * regions have to stay with regions referenced by the same submit.
+ *
+ * Caller must hold mem_sem.
+ *
+ **/
+static void lru_age()
+{
+	DWORD i;
+	DWORD fence_passed;
+	DWORD fence_last;
+	
+	if(lru_restoring > 0)
+		return;
+	
+	SVGA_fence_query(&fence_passed, &fence_last);
+	
+	for(i = 0; i < svga_db->regions_cnt; i++)
+	{
+		SVGA_DB_region_t *dbr = &svga_db->regions[i];
+		
+		if(dbr->pid == 0 || (dbr->flags & SVGA_DB_REGION_USED) == 0)
+			continue;
+		
+		if((dbr->flags & (SVGA_DB_REGION_EVICTABLE | SVGA_DB_REGION_EVICTED)) != SVGA_DB_REGION_EVICTABLE)
+			continue;
+		
+		dbr->flags &= ~SVGA_DB_REGION_USED;
+		dbr->last_fence = fence_last;
+	}
+}
+
+/**
+ * Send commands to all GB surfaces backed by this MOB
+ *
+ **/
+static void lru_surfaces_cmd(DWORD region_id, BOOL restore)
+{
+	DWORD id;
+	
+	if(!gb_support)
+		return;
+	
+	for(id = 0; id < svga_db->surfaces_cnt; id++)
+	{
+		SVGA_DB_surface_t *sinfo = &svga_db->surfaces[id];
+		if(sinfo->pid != 0 && sinfo->gmrId == region_id)
+		{
+			DWORD cmd_offset = 0;
+			SVGA3dCmdBindGBSurface *bind;
+			
+			wait_for_cmdbuf();
+			if(restore)
+			{
+				SVGA3dCmdUpdateGBSurface *update;
+				
+				bind = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_BIND_GB_SURFACE, sizeof(SVGA3dCmdBindGBSurface));
+				bind->sid   = id+1;
+				bind->mobid = region_id;
+				
+				update = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_UPDATE_GB_SURFACE, sizeof(SVGA3dCmdUpdateGBSurface));
+				update->sid = id+1;
+			}
+			else
+			{
+				SVGA3dCmdReadbackGBSurface *readback;
+				
+				readback = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_READBACK_GB_SURFACE, sizeof(SVGA3dCmdReadbackGBSurface));
+				readback->sid = id+1;
+				
+				bind = SVGA_cmd3d_ptr(cmdbuf, &cmd_offset, SVGA_3D_CMD_BIND_GB_SURFACE, sizeof(SVGA3dCmdBindGBSurface));
+				bind->sid   = id+1;
+				bind->mobid = SVGA3D_INVALID_ID;
+			}
+			submit_cmdbuf(cmd_offset, SVGA_CB_SYNC, 0);
+		}
+	}
+}
+
+static lru_evicted_t *lru_find(DWORD region_id)
+{
+	DWORD i;
+	for(i = 0; i < lru_evicted_cnt; i++)
+	{
+		if(lru_evicted[i].region_id == region_id)
+		{
+			return &lru_evicted[i];
+		}
+	}
+	
+	return NULL;
+}
+
+static void lru_remove(lru_evicted_t *ev)
+{
+	lru_evicted_cnt--;
+	*ev = lru_evicted[lru_evicted_cnt];
+}
+
+/**
+ * Release evicted region (called on region free)
+ *
+ * @return: TRUE if region was evicted
+ *
+ **/
+static BOOL lru_drop(DWORD region_id)
+{
+	lru_evicted_t *ev = lru_find(region_id);
+	if(ev)
+	{
+		_PageFree(ev->backup, 0);
+		lru_remove(ev);
+		return TRUE;
+	}
+	
+	return FALSE;
+}
+
+/**
+ * Move region data to swappable memory and release its GMR/MOB,
+ * caller must hold mem_sem
+ *
+ **/
+static BOOL lru_evict(SVGA_DB_region_t *dbr)
+{
+	lru_evicted_t *ev;
+	void *backup;
+	
+	if(lru_evicted_cnt >= LRU_EVICTED_MAX)
+		return FALSE;
+	
+	backup = (void*)_PageAllocate(RoundToPages(dbr->info.size), PG_SYS, 0, 0, 0x0, 0x100000, NULL, 0);
+	if(backup == NULL)
+		return FALSE;
+	
+	/* let HW flush surface content to MOB */
+	lru_surfaces_cmd(dbr->info.region_id, FALSE);
+	
+	memcpy(backup, dbr->info.address, dbr->info.size);
+	
+	region_free_locked(&dbr->info, dbr);
+	
+	ev = &lru_evicted[lru_evicted_cnt++];
+	ev->region_id = dbr->info.region_id;
+	ev->size      = dbr->info.size;
+	ev->mobonly   = dbr->info.mobonly;
+	ev->backup    = backup;
+	
+	dbr->flags |= SVGA_DB_REGION_EVICTED;
+	svga_db->stat_evictions++;
+	
+	dbg_printf("LRU: evicted region %ld (size: %ld)\n", ev->region_id, ev->size);
+	
+	return TRUE;
+}
+
+/**
+ * Evict cold regions until at least pages are released, caller must hold
+ * mem_sem. When there is nothing cold, give hot regions second chance and
+ * fail, they could be evicted by next request.
+ *
+ * @return: TRUE if something was evicted
+ *
+ **/
+static BOOL lru_evict_pages(DWORD pages)
+{
+	DWORD need = pages * P_SIZE;
+	DWORD freed = 0;
+	
+	if(svga_db == NULL)
+		return FALSE;
+	
+	while(freed < need)
+	{
+		SVGA_DB_region_t *victim = lru_victim();
+		DWORD size;
+		
+		if(victim == NULL)
+			break;
+		
+		size = victim->info.size;
+		if(!lru_evict(victim))
+			break;
+		
+		freed += size;
+	}
+	
+	if(freed == 0)
+	{
+		lru_age();
+	}
+	
+	return freed > 0;
+}
+
+BOOL SVGA_region_evict(DWORD pages)
+{
+	BOOL rc;
+	
+	Wait_Semaphore(mem_sem, 0);
+	rc = lru_evict_pages(pages);
+	Signal_Semaphore(mem_sem);
+	
+	return rc;
+}
+
+/**
+ * Bring evicted region back to GPU memory
+ *
+ **/
+BOOL SVGA_region_restore(DWORD region_id)
+{
+	SVGA_DB_region_t *dbr = SVGA_GetRegionInfo(region_id);
+	SVGA_region_info_t rinfo;
+	lru_evicted_t *ev;
+	
+	if(dbr == NULL)
+		return FALSE;
+	
+	memset(&rinfo, 0, sizeof(SVGA_region_info_t));
+	
+	Wait_Semaphore(mem_sem, 0);
+	ev = lru_find(region_id);
+	if(ev == NULL)
+	{
+		Signal_Semaphore(mem_sem);
+		return FALSE;
+	}
+	
+	rinfo.region_id = ev->region_id;
+	rinfo.size      = ev->size;
+	rinfo.mobonly   = ev->mobonly;
+	
+	/* keep region hot for next LRU sweep */
+	dbr->flags |= SVGA_DB_REGION_USED;
+	lru_restoring++;
+	Signal_Semaphore(mem_sem);
+	
+	if(!SVGA_region_create(&rinfo))
+	{
+		Wait_Semaphore(mem_sem, 0);
+		lru_restoring--;
+		Signal_Semaphore(mem_sem);
+		dbg_printf("LRU: restore region %ld failed\n", region_id);
+		return FALSE;
+	}
+	
+	Wait_Semaphore(mem_sem, 0);
+	lru_restoring--;
+	
+	/* could be moved by region_create or dropped by region free */
+	ev = lru_find(region_id);
+	if(ev == NULL)
+	{
+		region_free_locked(&rinfo, NULL);
+		Signal_Semaphore(mem_sem);
+		return FALSE;
+	}
+	
+	memcpy(rinfo.address, ev->backup, rinfo.size);
+	_PageFree(ev->backup, 0);
+	lru_remove(ev);
+	
+	memcpy(&dbr->info, &rinfo, sizeof(SVGA_region_info_t));
+	dbr->flags &= ~SVGA_DB_REGION_EVICTED;
+	
+	svga_db->stat_restores++;
+	Signal_Semaphore(mem_sem);
+	
+	lru_surfaces_cmd(region_id, TRUE);
+	
+	return TRUE;
+}
+
+/**
+ * Restore all evicted regions which user space wants to use
+ *
+ **/
+void SVGA_region_lru_restore()
+{
+	DWORD i = 0;
+	
+	/* no second chance sweep until all regions of this submit are back */
+	Wait_Semaphore(mem_sem, 0);
+	lru_restoring++;
+	Signal_Semaphore(mem_sem);
+	
+	for(;;)
+	{
+		DWORD region_id;
+		SVGA_DB_region_t *dbr;
+		
+		Wait_Semaphore(mem_sem, 0);
+		if(i >= lru_evicted_cnt)
+		{
+			lru_restoring--;
+			Signal_Semaphore(mem_sem);
+			break;
+		}
+		region_id = lru_evicted[i].region_id;
+		Signal_Semaphore(mem_sem);
+		
+		dbr = SVGA_GetRegionInfo(region_id);
+		if(dbr != NULL && (dbr->flags & SVGA_DB_REGION_USED) != 0)
+		{
+			if(SVGA_region_restore(region_id))
+			{
+				/* item was removed, check same position again */
+				continue;
+			}
+		}
+		i++;
+	}
+}
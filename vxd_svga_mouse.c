@@ -46,11 +46,13 @@ THE SOFTWARE.
 
 extern FBHDA_t *hda;
 extern DWORD hw_cursor;
+extern DWORD hw_cursor_alpha;
 
 static BOOL hw_cursor_valid = FALSE;
 static BOOL hw_cursor_visible = FALSE;
 static DWORD mouse_last_x = 0;
 static DWORD mouse_last_y = 0;
+static DWORD hw_cursor_serial = 0; /* cache serial of shape defined in device */
 
 static DWORD conv_mask16to32(void *in, void *out, int w, int h)
 {
@@ -141,7 +143,86 @@ static DWORD conv_mask(void *in, DWORD in_bpp, void *out, DWORD *out_bpp, int w,
 	return 0;
 }
 
-BOOL SVGA_mouse_load()
+/*
+ * Compose AND + XOR mask into one BGRA image:
+ *   AND=0         -> opaque XOR color
+ *   AND=1, XOR=0  -> transparent
+ *   AND=1, XOR!=0 -> screen inversion, not possible with alpha,
+ *                    return FALSE and let caller use mask cursor
+ */
+static BOOL conv_alpha(CURSORSHAPE *cur, DWORD *out)
+{
+	BYTE *andmask = (BYTE*)(cur+1);
+	BYTE *xormask = andmask + cur->cbWidth * cur->cy;
+	DWORD xorpitch;
+	int x, y;
+	
+	switch(cur->BitsPixel)
+	{
+		case 1:
+			xorpitch = cur->cbWidth;
+			break;
+		case 16:
+			xorpitch = cur->cx * 2;
+			break;
+		case 32:
+			xorpitch = cur->cx * 4;
+			break;
+		default:
+			return FALSE;
+	}
+	
+	for(y = 0; y < cur->cy; y++)
+	{
+		for(x = 0; x < cur->cx; x++)
+		{
+			DWORD a = ((andmask[x >> 3] << (x & 0x7)) >> 7) & 0x1;
+			DWORD c;
+			
+			switch(cur->BitsPixel)
+			{
+				case 1:
+					c = (((xormask[x >> 3] << (x & 0x7)) >> 7) & 0x1) ? 0x00FFFFFF : 0;
+					break;
+				case 16:
+				{
+					DWORD px16 = ((WORD*)xormask)[x];
+					c = ((px16 & 0xF800) << 8) | ((px16 & 0x07E0) << 5) | ((px16 & 0x001F) << 3);
+					break;
+				}
+				default:
+					c = ((DWORD*)xormask)[x] & 0x00FFFFFF;
+					break;
+			}
+			
+			if(a == 0)
+			{
+				*out = 0xFF000000UL | c;
+			}
+			else if(c == 0)
+			{
+				*out = 0;
+			}
+			else
+			{
+				return FALSE;
+			}
+			out++;
+		}
+		
+		andmask += cur->cbWidth;
+		xormask += xorpitch;
+	}
+	
+	return TRUE;
+}
+
+/*
+ * Load cursor from mouse buffer, serial is ID of shape in cursor cache
+ * (0 = not cached). When the same shape is already in device, only
+ * show it.
+ */
+BOOL SVGA_mouse_load(DWORD serial)
 {
 	SVGAFifoCmdDefineCursor *cursor;
 	DWORD cmdoff = 0;
@@ -149,6 +230,14 @@ BOOL SVGA_mouse_load()
 	void *mb;
 	CURSORSHAPE *cur;
 	
+	if(serial != 0 && serial == hw_cursor_serial)
+	{
+		hw_cursor_valid = TRUE;
+		hw_cursor_visible = TRUE;
+		SVGA_mouse_move(mouse_last_x, mouse_last_y);
+		return TRUE;
+	}
+	
 	SVGA_mouse_hide(TRUE);
 	
 	mb = mouse_buffer();
@@ -166,6 +255,34 @@ BOOL SVGA_mouse_load()
 		
 	wait_for_cmdbuf();
 	
+	if(hw_cursor_alpha && (gSVGA.capabilities & SVGA_CAP_ALPHA_CURSOR))
+	{
+		SVGAFifoCmdDefineAlphaCursor *acursor;
+		
+		acursor = SVGA_cmd_ptr(cmdbuf, &cmdoff, SVGA_CMD_DEFINE_ALPHA_CURSOR, sizeof(SVGAFifoCmdDefineAlphaCursor));
+		if(conv_alpha(cur, (DWORD*)(((BYTE*)cmdbuf)+cmdoff)))
+		{
+			acursor->id       = 0;
+			acursor->hotspotX = cur->xHotSpot;
+			acursor->hotspotY = cur->yHotSpot;
+			acursor->width    = cur->cx;
+			acursor->height   = cur->cy;
+			
+			cmdoff += cur->cx * cur->cy * sizeof(DWORD);
+			submit_cmdbuf(cmdoff, SVGA_CB_SYNC, 0);
+			
+			hw_cursor_serial = serial;
+			hw_cursor_valid = TRUE;
+			hw_cursor_visible = TRUE;
+			SVGA_mouse_move(mouse_last_x, mouse_last_y);
+			
+			return TRUE;
+		}
+		
+		/* inverted pixels, rewrite buffer with mask cursor */
+		cmdoff = 0;
+	}
+	
   cursor = SVGA_cmd_ptr(cmdbuf, &cmdoff, SVGA_CMD_DEFINE_CURSOR, sizeof(SVGAFifoCmdDefineCursor));
 
   mask_size = conv_mask(cur+1, 1, ((BYTE*)cmdbuf)+cmdoff, &(cursor->andMaskDepth),
@@ -180,10 +297,11 @@ BOOL SVGA_mouse_load()
 	cursor->hotspotX = cur->xHotSpot;
 	cursor->hotspotY = cur->yHotSpot;
 	cursor->width    = cur->cx;
-	cursor->height   = cur->cx;
+	cursor->height   = cur->cy;
 	
 	submit_cmdbuf(cmdoff, SVGA_CB_SYNC, 0);
 	
+	hw_cursor_serial = serial;
 	hw_cursor_valid = TRUE;
 	hw_cursor_visible = TRUE;
 	SVGA_mouse_move(mouse_last_x, mouse_last_y);
@@ -252,6 +370,7 @@ void SVGA_mouse_hide(BOOL invalidate)
 	if(invalidate)
 	{
 		hw_cursor_valid = FALSE;
+		hw_cursor_serial = 0;
 	}
 	
 	hw_cursor_visible = FALSE;
@@ -57,6 +57,7 @@ THE SOFTWARE.
 #define ISA_LFB 0xE0000000UL
 
 static BOOL vbe_is_valid = FALSE;
+static DWORD vbe_virt_height = 0; /* lines usable for Y offset */
 extern FBHDA_t *hda;
 extern LONG fb_lock_cnt;
 extern BOOL vram_heap_in_ram;
@@ -70,6 +71,8 @@ static char vbe_vxd_name[] = "boxvmini.vxd";
 
 #include "vxd_strings.h"
 
+static char VBE_conf_path[] = "Software\\vmdisp9x\\vbe";
+
 static inline void wridx(unsigned short idx_reg, unsigned char idx, unsigned char data)
 {
 	outpw(idx_reg, (unsigned short)idx | (((unsigned short)data) << 8));
@@ -132,6 +135,9 @@ BOOL VBE_init_hw()
 {
 	DWORD vram_size;
 	DWORD vram_phy;
+	DWORD conf_mtrr = 1;
+	
+	RegReadConf(HKEY_LOCAL_MACHINE, VBE_conf_path, "MTRR", &conf_mtrr);
 	
 	vbe_chip_id = VBE_detect(&vram_size);
 	if(vbe_chip_id == 0)
@@ -153,12 +159,16 @@ BOOL VBE_init_hw()
 	hda->vram_bar_size = vram_size;
 
 	hda->vram_pm32 = (void*)_MapPhysToLinear(vram_phy, vram_size, 0);
-	hda->flags    |= FB_SUPPORT_FLIPING;
 
 #ifndef QEMU
 	FBHDA_memtest();
 #endif
 	
+	if(conf_mtrr && hda->vram_pm32 != NULL)
+	{
+		FBHDA_write_combine(vram_phy, vram_size);
+	}
+	
 	memcpy(hda->vxdname, vbe_vxd_name, sizeof(vbe_vxd_name));
 	
 	dbg_printf(dbg_vbe_lfb, hda->vram_pm32);
@@ -213,11 +223,13 @@ BOOL VBE_validmode(DWORD w, DWORD h, DWORD bpp)
 
 void VBE_clear()
 {
-	memset(hda->vram_pm32, 0, hda->pitch*hda->height);
+	fb_memset(hda->vram_pm32, 0, hda->pitch*hda->height);
 }
 
 BOOL VBE_setmode(DWORD w, DWORD h, DWORD bpp)
 {
+	DWORD virt_h;
+
 	if(!VBE_validmode(w, h, bpp)) return FALSE;
 
 	/* Put the hardware into a state where the mode can be safely set. */
@@ -243,8 +255,11 @@ BOOL VBE_setmode(DWORD w, DWORD h, DWORD bpp)
 	/* Set the virtual resolution. (same as FB resolution) */
 	outpw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_VIRT_WIDTH);
 	outpw(VBE_DISPI_IOPORT_DATA, (WORD)w);
+	/* virtual height over whole VRAM, so we can flip by Y offset */
+	virt_h = hda->vram_size / VBE_pitch(w, bpp);
+	if(virt_h > 0xFFFF) virt_h = 0xFFFF;
 	outpw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_VIRT_HEIGHT);
-	outpw(VBE_DISPI_IOPORT_DATA, (WORD)h);
+	outpw(VBE_DISPI_IOPORT_DATA, (WORD)virt_h);
 	/* Reset the current bank. */
 	outpw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_BANK);
 	outpw(VBE_DISPI_IOPORT_DATA, 0);
@@ -261,6 +276,10 @@ BOOL VBE_setmode(DWORD w, DWORD h, DWORD bpp)
 	outpw(VBE_DISPI_IOPORT_DATA, VBE_DISPI_ENABLED | VBE_DISPI_8BIT_DAC);
 #endif
 
+	/* some implementations calculate virtual height itself, read real value */
+	outpw(VBE_DISPI_IOPORT_INDEX, VBE_DISPI_INDEX_VIRT_HEIGHT);
+	vbe_virt_height = inpw(VBE_DISPI_IOPORT_DATA);
+
 	/* Re-enable the sequencer. */
 	wridx(VGA_SEQUENCER, VGA_SR_RESET, VGA_SR0_NORESET);
 
@@ -274,12 +293,26 @@ BOOL VBE_setmode(DWORD w, DWORD h, DWORD bpp)
 	hda->pitch  = VBE_pitch(w, bpp);
 	hda->stride = h * hda->pitch;
 	hda->surface = 0;
+	hda->system_surface = 0;
+	
+	hda->flags &= ~(FB_SUPPORT_FLIPING | FB_SUPPORT_TRIPLE);
+	if(vbe_virt_height >= 2*h)
+	{
+		hda->flags |= FB_SUPPORT_FLIPING;
+		if(vbe_virt_height >= 3*h)
+		{
+			hda->flags |= FB_SUPPORT_TRIPLE;
+		}
+	}
+	dbg_printf("VBE virtual height: %ld\n", vbe_virt_height);
 	
 	VBE_clear();
 
 	mouse_invalidate();
 	FBHDA_update_heap_size(FALSE, vram_heap_in_ram);
 
+	FBHDA_vblank_measure();
+
 	return TRUE;
 }
 
@@ -291,6 +324,26 @@ void  FBHDA_palette_set(unsigned char index, DWORD rgb)
 	outp(VGA_DAC_DATA,    rgb        & 0xFF);
 }
 
+void FBHDA_palette_set_range(DWORD start, DWORD count, DWORD *colors)
+{
+	DWORD i;
+
+	if(start >= 256)
+		return;
+
+	if(start + count > 256)
+		count = 256 - start;
+
+	outp(VGA_DAC_W_INDEX, start);    /* index is auto-incremented */
+	for(i = 0; i < count; i++)
+	{
+		outp(VGA_DAC_DATA,   (colors[i] >> 16) & 0xFF);
+		outp(VGA_DAC_DATA,   (colors[i] >>  8) & 0xFF);
+		outp(VGA_DAC_DATA,    colors[i]        & 0xFF);
+	}
+	hda->palette_update++;
+}
+
 DWORD FBHDA_palette_get(unsigned char index)
 {
 	DWORD r, g, b;
@@ -303,6 +356,17 @@ DWORD FBHDA_palette_get(unsigned char index)
 	return (r << 16) | (g << 8) | b;
 }
 
+/* display start register is applied immediately */
+BOOL FBHDA_swap_ready()
+{
+	return TRUE;
+}
+
+BOOL FBHDA_swap_queued(DWORD offset)
+{
+	return FBHDA_swap(offset);
+}
+
 BOOL FBHDA_swap(DWORD offset)
 {
 	DWORD ps = ((hda->bpp+7)/8);
@@ -310,6 +374,7 @@ BOOL FBHDA_swap(DWORD offset)
 	DWORD offset_x = (offset % hda->pitch)/ps;
 	
 	if(offset + hda->stride > hda->vram_size) return FALSE; /* if exceed VRAM */
+	if(offset_y + hda->height > vbe_virt_height) return FALSE; /* HW would clamp Y offset */
 		
 	FBHDA_access_begin(0);
 	
@@ -321,6 +386,8 @@ BOOL FBHDA_swap(DWORD offset)
 	hda->surface = offset;
 	
 	FBHDA_access_end(0);
+	
+	FBHDA_present_mark();
 
 	return TRUE;
 }
@@ -348,6 +415,7 @@ void FBHDA_access_end(DWORD flags)
 	{
 		mouse_blit();
 		// cursor
+		FBHDA_swap_flush(FALSE);
 	}
 	
 	//Signal_Semaphore(hda_sem);
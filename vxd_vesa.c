@@ -35,7 +35,6 @@ THE SOFTWARE.
 #include "pci.h" /* re-use PCI functions from SVGA */
 
 #include "vesa.h"
-#include "mtrr.h"
 
 #define IO_IN8
 #define IO_OUT8
@@ -43,6 +42,8 @@ THE SOFTWARE.
 
 #include "code32.h"
 
+#include "vxd_rect.h"
+
 #define ISA_LFB 0xE0000000UL
 
 extern FBHDA_t *hda;
@@ -68,11 +69,31 @@ WORD vesa_version = 0;
 static DWORD vesa_caps = 0;
 static int act_mode = -1;
 
-/* access rect */
-static DWORD rect_left;
-static DWORD rect_top;
-static DWORD rect_right;
-static DWORD rect_bottom;
+/* access rects */
+static dirty_list_t dirty;
+
+/*
+ * tile change detection for SCREEN_EMULATED_COPY: tiles are compared
+ * exactly against system RAM copy of what is on screen (front buffer)
+ */
+#define TILE_SIZE 32
+
+static BYTE *tile_front = NULL;
+static DWORD tile_front_pages = 0;
+static DWORD tiles_x = 0;
+static DWORD tiles_y = 0;
+static BOOL tile_front_valid = FALSE;
+
+/*
+ * System RAM shadow for SCREEN_EMULATED_COPY: the LFB is mapped page by page
+ * (_PageCommitPhys), so pages of the back surface could be decommitted and
+ * replaced by cached system RAM at the same linear address. The 16-bit driver,
+ * DirectDraw and FBHDA_swap see no difference, only reads are fast.
+ */
+static DWORD lfb_phy = 0;
+static BOOL lfb_reserved = FALSE;
+static DWORD shadow_page = 0; /* first shadow page relative to vram_pm32 */
+static DWORD shadow_pages = 0;
 
 extern BOOL vram_heap_in_ram;
 
@@ -126,6 +147,10 @@ static BOOL vesa_valid = FALSE;
 
 static DWORD conf_dos_window = 0;
 static DWORD conf_hw_double_buf = 2;
+static DWORD conf_tile_compare = 0;
+static DWORD conf_ram_shadow = 0;
+static DWORD conf_async_flip = 1;
+static DWORD conf_pm_interface = 1;
 
 #define SCREEN_EMULATED_CENTER 0
 #define SCREEN_EMULATED_COPY   1
@@ -134,6 +159,18 @@ static DWORD conf_hw_double_buf = 2;
 
 static DWORD screen_mode = SCREEN_EMULATED_COPY;
 
+/* SCREEN_FLIP_VSYNC without BIOS waiting and read back */
+#define FLIP_ASYNC_NONE     0
+#define FLIP_ASYNC_VGA      1 /* 4F07h/00h, CRTC latch start address in vertical retrace */
+#define FLIP_ASYNC_SCHEDULE 2 /* 4F07h/02h, VBE 3.0 hardware triple buffering */
+
+#define FLIP_TIMEOUT_MS 17 /* one frame at 60 Hz */
+
+static DWORD flip_async = FLIP_ASYNC_NONE;
+static BOOL flip_pending = FALSE;
+static BOOL flip_seen_active = FALSE;
+static DWORD flip_time = 0;
+
 #define MODE_OFFSET 1024
 #define CRTC_OFFSET 2048
 #define PAL_OFFSET  3072 // pal size = 4*256
@@ -160,14 +197,405 @@ static void alloc_modes_info(DWORD cnt)
 	vesa_modes_cnt = 0;
 }
 
+/*
+ * Mode index: vesa_modes are sorted by (width, height, bpp) and compact copy
+ * is published in FBHDA, so 16-bit driver can validate modes without VXD call.
+ */
+static int VESA_mode_cmp(vesa_mode_t *m, DWORD w, DWORD h, DWORD bpp)
+{
+	if(m->width != w)  return (m->width  < w) ? -1 : 1;
+	if(m->height != h) return (m->height < h) ? -1 : 1;
+	if(m->bpp != bpp)  return (m->bpp    < bpp) ? -1 : 1;
+	return 0;
+}
+
+/* return first index of mode or -1 */
+static int VESA_mode_find(DWORD w, DWORD h, DWORD bpp)
+{
+	int lo = 0;
+	int hi = vesa_modes_cnt;
+
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(VESA_mode_cmp(&vesa_modes[mid], w, h, bpp) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if((DWORD)lo < vesa_modes_cnt && VESA_mode_cmp(&vesa_modes[lo], w, h, bpp) == 0)
+	{
+		return lo;
+	}
+
+	return -1;
+}
+
+static void VESA_modes_index()
+{
+	DWORD i, j, cnt;
+
+	/* insertion sort, stable so BIOS order of same modes is kept */
+	for(i = 1; i < vesa_modes_cnt; i++)
+	{
+		vesa_mode_t t = vesa_modes[i];
+		for(j = i; j > 0 && VESA_mode_cmp(&vesa_modes[j-1], t.width, t.height, t.bpp) > 0; j--)
+		{
+			vesa_modes[j] = vesa_modes[j-1];
+		}
+		vesa_modes[j] = t;
+	}
+
+	hda->modes_cnt = 0;
+	cnt = 0;
+	for(i = 0; i < vesa_modes_cnt; i++)
+	{
+		vesa_mode_t *m = &vesa_modes[i];
+
+		if((m->flags & VESA_MODE_HW_SUPPORTED) == 0)
+			continue;
+
+		/* skip duplicates */
+		if(cnt > 0 && hda->modes[cnt-1].width == m->width &&
+			hda->modes[cnt-1].height == m->height && hda->modes[cnt-1].bpp == m->bpp)
+			continue;
+
+		if(cnt == FBHDA_MODES_MAX)
+		{
+			/* incomplete index is useless */
+			cnt = 0;
+			break;
+		}
+
+		hda->modes[cnt].width   = (WORD)m->width;
+		hda->modes[cnt].height  = (WORD)m->height;
+		hda->modes[cnt].bpp     = (WORD)m->bpp;
+		hda->modes[cnt].refresh = 0;
+		cnt++;
+	}
+	hda->modes_cnt = cnt;
+}
+
+/*
+ * VBE 2.0 protected mode interface (4F0Ah). The BIOS code is copied to RAM
+ * and called directly from RING-0 flat segment. Functions which need memory
+ * mapped registers (selector in ES) aren't supported, V86 is used instead.
+ */
+static BYTE *vesa_pm_code = NULL;
+static DWORD vesa_pm_display_start = 0;
+static DWORD vesa_pm_palette = 0;
+
+static void VESA_load_vbios_pm()
+{
+	CRS_32 regs;
+	WORD *table;
+	WORD *ports;
+	DWORD table_size;
+	DWORD pages;
+
+	load_client_state(&regs);
+	regs.Client_EAX = VESA_CMD_PM_INTERFACE;
+	regs.Client_EBX = 0;
+	vesa_bios(&regs);
+
+	if(!VESA_SUCC(regs))
+	{
+		dbg_printf("VBE PM interface not supported\n");
+		return;
+	}
+
+	table = (WORD*)(((regs.Client_ES & 0xFFFF) << 4) + (regs.Client_EDI & 0xFFFF));
+	table_size = regs.Client_ECX & 0xFFFF;
+	if(table_size < 4*sizeof(WORD))
+	{
+		return;
+	}
+
+	if(table[VESA_PMTABLE_OFF_PORTS] != 0)
+	{
+		/* skip I/O ports list (terminated by 0xFFFF), then memory list follows */
+		ports = (WORD*)(((BYTE*)table) + table[VESA_PMTABLE_OFF_PORTS]);
+		while(*ports != 0xFFFF)
+		{
+			ports++;
+		}
+		ports++;
+		if(*ports != 0xFFFF)
+		{
+			dbg_printf("VBE PM interface needs MMIO selector, using V86\n");
+			return;
+		}
+	}
+
+	pages = (table_size + P_SIZE - 1) / P_SIZE;
+	vesa_pm_code = (BYTE*)_PageAllocate(pages, PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
+	if(vesa_pm_code == NULL)
+	{
+		return;
+	}
+	memcpy(vesa_pm_code, table, table_size);
+
+	table = (WORD*)vesa_pm_code;
+	vesa_pm_display_start = (DWORD)vesa_pm_code + table[VESA_PMTABLE_OFF_DISPLAY_START];
+	vesa_pm_palette       = (DWORD)vesa_pm_code + table[VESA_PMTABLE_OFF_PALETTE_DATA];
+
+	dbg_printf("VBE PM interface loaded, size=%ld\n", table_size);
+}
+
+/* call BIOS protected mode function, ES = DS (flat) */
+static void vesa_pm_call(DWORD func, DWORD r_eax, DWORD r_ebx, DWORD r_ecx, DWORD r_edx, DWORD r_edi)
+{
+	_asm
+	{
+		pushad
+		push es
+		mov ax, ds
+		mov es, ax
+		mov esi, [func]
+		mov eax, [r_eax]
+		mov ebx, [r_ebx]
+		mov ecx, [r_ecx]
+		mov edx, [r_edx]
+		mov edi, [r_edi]
+		push ebp
+		call esi
+		pop ebp
+		pop es
+		popad
+	}
+}
+
+/* PM display start is in DWORDs (VBE 2.0, 8 and more bpp) */
+static void vesa_pm_set_start(DWORD offset, BOOL vtrace)
+{
+	DWORD start = offset >> 2;
+
+	vesa_pm_call(vesa_pm_display_start, VESA_CMD_DISPLAY_START,
+		vtrace ? VESA_DISPLAYSTART_VTRACE : VESA_DISPLAYSTART_SET,
+		start & 0xFFFF, (start >> 16) & 0xFFFF, 0);
+}
+
 static char VESA_conf_path[] = "Software\\vmdisp9x\\vesa";
 
+/*
+ * Mode list cache: mode enumeration (4F01h per mode) and memory test could
+ * be very slow on real HW, so results are saved in registry and reused
+ * when video BIOS and configuration are same. Cached mode is checked again
+ * by single 4F01h call when is set, on mismatch the cache is dropped.
+ */
+static char VESA_cache_path[] = "Software\\vmdisp9x\\vesa\\cache";
+
+#define VESA_CACHE_MAGIC 0x31434D56UL /* VMC1 */
+#define VESA_CACHE_MODES_MAX 512
+
+typedef struct vesa_cache_fp
+{
+	DWORD magic;
+	DWORD version;    /* VESAVersion | OemSoftwareRev << 16 */
+	DWORD total_mem;  /* in 64k blocks */
+	DWORD caps;
+	DWORD rom_sum;
+	DWORD vram_limit;
+	char  oem[32];
+} vesa_cache_fp_t;
+
+typedef struct vesa_cache_head
+{
+	vesa_cache_fp_t fp;
+	DWORD fb_phy;
+	DWORD vram_size;  /* after memtest */
+	DWORD modes_cnt;
+} vesa_cache_head_t;
+
+static BOOL vesa_modes_cached = FALSE;
+
+static void VESA_cache_fingerprint(vesa_info_block_t *info, DWORD vram_limit, vesa_cache_fp_t *fp)
+{
+	BYTE *rom = (BYTE*)0xC0000UL;
+	char *oem;
+	DWORD i;
+
+	memset(fp, 0, sizeof(vesa_cache_fp_t));
+	fp->magic      = VESA_CACHE_MAGIC;
+	fp->version    = info->VESAVersion | ((DWORD)info->OemSoftwareRev << 16);
+	fp->total_mem  = info->TotalMemory;
+	fp->caps       = info->Capabilities;
+	fp->vram_limit = vram_limit;
+
+	if(info->OEMStringPtr)
+	{
+		oem = (char*)LIN_FROM_V86(info->OEMStringPtr);
+		for(i = 0; i < sizeof(fp->oem)-1 && oem[i] != '\0'; i++)
+		{
+			fp->oem[i] = oem[i];
+		}
+	}
+
+	/* video BIOS ROM, size in 512 B blocks */
+	if(rom[0] == 0x55 && rom[1] == 0xAA)
+	{
+		DWORD *rom32 = (DWORD*)rom;
+		DWORD size4 = ((DWORD)rom[2] * 512) / 4;
+		DWORD sum = 0;
+
+		for(i = 0; i < size4; i++)
+		{
+			sum = ((sum << 1) | (sum >> 31)) ^ rom32[i];
+		}
+		fp->rom_sum = sum;
+	}
+}
+
+/* return TRUE and fill vesa_modes when cache matches fingerprint */
+static BOOL VESA_cache_load(vesa_cache_fp_t *fp, DWORD *fb_phy, DWORD *vram_size)
+{
+	vesa_cache_head_t head;
+	DWORD size = sizeof(head);
+
+	if(!RegReadBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Head", &head, &size))
+	{
+		return FALSE;
+	}
+
+	if(size != sizeof(head) || head.modes_cnt == 0 || head.modes_cnt > VESA_CACHE_MODES_MAX)
+	{
+		return FALSE;
+	}
+
+	if(memcmp(&head.fp, fp, sizeof(vesa_cache_fp_t)) != 0)
+	{
+		dbg_printf("VESA cache: fingerprint mismatch\n");
+		return FALSE;
+	}
+
+	alloc_modes_info(head.modes_cnt);
+	if(vesa_modes == NULL)
+	{
+		return FALSE;
+	}
+
+	size = head.modes_cnt * sizeof(vesa_mode_t);
+	if(!RegReadBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Modes", vesa_modes, &size) ||
+		size != head.modes_cnt * sizeof(vesa_mode_t))
+	{
+		_PageFree(vesa_modes, 0);
+		vesa_modes = NULL;
+		return FALSE;
+	}
+
+	vesa_modes_cnt = head.modes_cnt;
+	*fb_phy        = head.fb_phy;
+	*vram_size     = head.vram_size;
+
+	dbg_printf("VESA cache: %ld modes loaded\n", vesa_modes_cnt);
+
+	return TRUE;
+}
+
+static void VESA_cache_save(vesa_cache_fp_t *fp, DWORD fb_phy, DWORD vram_size)
+{
+	vesa_cache_head_t head;
+
+	if(vesa_modes_cnt == 0 || vesa_modes_cnt > VESA_CACHE_MODES_MAX)
+	{
+		return;
+	}
+
+	memcpy(&head.fp, fp, sizeof(vesa_cache_fp_t));
+	head.fb_phy    = fb_phy;
+	head.vram_size = vram_size;
+	head.modes_cnt = vesa_modes_cnt;
+
+	/* invalidate head first, so interrupted write cannot leave valid head with bad modes */
+	RegWriteBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Head", "", 1);
+	if(RegWriteBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Modes", vesa_modes, vesa_modes_cnt * sizeof(vesa_mode_t)))
+	{
+		RegWriteBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Head", &head, sizeof(vesa_cache_head_t));
+	}
+}
+
+/* modes stay in use (each is checked before set), only stored copy is invalidated */
+static void VESA_cache_drop()
+{
+	static BOOL dropped = FALSE;
+
+	if(!dropped)
+	{
+		dbg_printf("VESA cache: dropped\n");
+		RegWriteBin(HKEY_LOCAL_MACHINE, VESA_cache_path, "Head", "", 1);
+		dropped = TRUE;
+	}
+}
+
+/* re-read cached mode from BIOS and refresh it, FALSE on mismatch */
+static BOOL VESA_cache_check(vesa_mode_t *m)
+{
+	CRS_32 regs;
+	vesa_mode_info_t *modeinfo = (vesa_mode_info_t*)((char*)vesa_buf + MODE_OFFSET);
+
+	load_client_state(&regs);
+	regs.Client_EAX = VESA_CMD_MODE_INFO;
+	regs.Client_ECX = m->mode_id;
+	regs.Client_ES  = V86_SEG(vesa_buf_v86+MODE_OFFSET);
+	regs.Client_EDI = V86_OFF(vesa_buf_v86+MODE_OFFSET);
+	vesa_bios(&regs);
+
+	if(!VESA_SUCC(regs))
+	{
+		m->flags = 0; /* don't use this mode anymore */
+		return FALSE;
+	}
+
+	if(modeinfo->XResolution != m->width || modeinfo->YResolution != m->height ||
+		modeinfo->BitsPerPixel != m->bpp)
+	{
+		m->flags = 0;
+		return FALSE;
+	}
+
+	if(modeinfo->BytesPerScanLine != m->pitch || modeinfo->PhysBasePtr != m->phy)
+	{
+		m->pitch = modeinfo->BytesPerScanLine;
+		m->phy   = modeinfo->PhysBasePtr;
+		m->flags = modeinfo->ModeAttributes;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* LFB address could be moved (PCI BAR reassigned) without fingerprint change */
+static BOOL VESA_cache_lfb_check(DWORD fb_phy)
+{
+	DWORD i;
+
+	for(i = 0; i < vesa_modes_cnt; i++)
+	{
+		if(vesa_modes[i].phy == fb_phy)
+		{
+			if(!VESA_cache_check(&vesa_modes[i]))
+			{
+				dbg_printf("VESA cache: LFB moved to 0x%lX\n", vesa_modes[i].phy);
+				return FALSE;
+			}
+			return TRUE;
+		}
+	}
+
+	/* no mode with LFB, nothing to compare */
+	return TRUE;
+}
+
 BOOL VESA_init_hw()
 {
 	DWORD flat;
 	DWORD conf_vram_limit = 128;
 	DWORD conf_mtrr = 1;
 	DWORD conf_no_memtest = 0;
+	DWORD conf_mode_cache = 1;
+	DWORD cached_vram = 0;
+	vesa_cache_fp_t cache_fp;
 	
 	dbg_printf("VESA init begin...\n");
 
@@ -176,6 +604,11 @@ BOOL VESA_init_hw()
 	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "DosWindowSetMode", &conf_dos_window);
 	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "HWDoubleBuffer",   &conf_hw_double_buf);
 	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "NoMemTest",        &conf_no_memtest);
+	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "TileCompare",      &conf_tile_compare);
+	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "RAMShadow",        &conf_ram_shadow);
+	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "AsyncFlip",        &conf_async_flip);
+	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "PMInterface",      &conf_pm_interface);
+	RegReadConf(HKEY_LOCAL_MACHINE, VESA_conf_path, "ModeCache",        &conf_mode_cache);
 
 	flat = _PageAllocate(1, PG_SYS, 0, 0x0, 0, 0x100000, &vesa_buf_phy, PAGEUSEALIGN | PAGECONTIG | PAGEFIXED);
 	vesa_buf = (void*)flat;
@@ -224,59 +657,80 @@ BOOL VESA_init_hw()
 					return FALSE;
 				}
 
-				modes = (WORD*)LIN_FROM_V86(info->VideoModePtr);
-				if(modes != NULL)
+				VESA_cache_fingerprint(info, conf_vram_limit, &cache_fp);
+				if(conf_mode_cache && VESA_cache_load(&cache_fp, &fb_phy, &cached_vram))
 				{
-					while(*modes != 0xFFFF)
+					if(VESA_cache_lfb_check(fb_phy))
+					{
+						vesa_modes_cached = TRUE;
+					}
+					else
 					{
-						//dbg_printf("modes: 0x%04X\n", *modes);
-						modes++;
-						modes_count++;
+						/* stored cache is rewritten after enumeration */
+						_PageFree(vesa_modes, 0);
+						vesa_modes = NULL;
+						vesa_modes_cnt = 0;
+						fb_phy = 0xFFFFFFFF;
+						cached_vram = 0;
 					}
 				}
 
-				alloc_modes_info(modes_count);
-				modes = (WORD*)LIN_FROM_V86(info->VideoModePtr);
-
-				for(i = 0; i < modes_count; i++)
+				if(!vesa_modes_cached)
 				{
-					regs.Client_EAX = VESA_CMD_MODE_INFO;
-					regs.Client_ECX = modes[i];
-					regs.Client_ES  = V86_SEG(vesa_buf_v86+MODE_OFFSET);
-					regs.Client_EDI = V86_OFF(vesa_buf_v86+MODE_OFFSET);
+					modes = (WORD*)LIN_FROM_V86(info->VideoModePtr);
+					if(modes != NULL)
+					{
+						while(*modes != 0xFFFF)
+						{
+							//dbg_printf("modes: 0x%04X\n", *modes);
+							modes++;
+							modes_count++;
+						}
+					}
 
-					vesa_bios(&regs);
+					alloc_modes_info(modes_count);
+					modes = (WORD*)LIN_FROM_V86(info->VideoModePtr);
 
-					//dbg_printf("mode=%X atrs=0x%lX eax=0x%lX\n", modes[i], modeinfo->ModeAttributes, regs.Client_EAX);
-					if(VESA_SUCC(regs))
+					for(i = 0; i < modes_count; i++)
 					{
-						if((modeinfo->ModeAttributes &
-							(VESA_MODE_HW_SUPPORTED | VESA_MODE_COLOR | VESA_MODE_GRAPHICS | VESA_MODE_LFB)) ==
-							(VESA_MODE_HW_SUPPORTED | VESA_MODE_COLOR | VESA_MODE_GRAPHICS | VESA_MODE_LFB))
+						regs.Client_EAX = VESA_CMD_MODE_INFO;
+						regs.Client_ECX = modes[i];
+						regs.Client_ES  = V86_SEG(vesa_buf_v86+MODE_OFFSET);
+						regs.Client_EDI = V86_OFF(vesa_buf_v86+MODE_OFFSET);
+
+						vesa_bios(&regs);
+
+						//dbg_printf("mode=%X atrs=0x%lX eax=0x%lX\n", modes[i], modeinfo->ModeAttributes, regs.Client_EAX);
+						if(VESA_SUCC(regs))
 						{
-							vesa_mode_t *m = &vesa_modes[vesa_modes_cnt];
-							m->width   = modeinfo->XResolution;
-							m->height  = modeinfo->YResolution;
-							m->bpp     = modeinfo->BitsPerPixel;
-							m->pitch   = modeinfo->BytesPerScanLine;
-							m->phy     = modeinfo->PhysBasePtr;
-							m->mode_id = modes[i];
-							m->flags   = modeinfo->ModeAttributes;
-							vesa_modes_cnt++;
-
-							if(m->phy)
+							if((modeinfo->ModeAttributes &
+								(VESA_MODE_HW_SUPPORTED | VESA_MODE_COLOR | VESA_MODE_GRAPHICS | VESA_MODE_LFB)) ==
+								(VESA_MODE_HW_SUPPORTED | VESA_MODE_COLOR | VESA_MODE_GRAPHICS | VESA_MODE_LFB))
 							{
-								if(m->phy < fb_phy)
+								vesa_mode_t *m = &vesa_modes[vesa_modes_cnt];
+								m->width   = modeinfo->XResolution;
+								m->height  = modeinfo->YResolution;
+								m->bpp     = modeinfo->BitsPerPixel;
+								m->pitch   = modeinfo->BytesPerScanLine;
+								m->phy     = modeinfo->PhysBasePtr;
+								m->mode_id = modes[i];
+								m->flags   = modeinfo->ModeAttributes;
+								vesa_modes_cnt++;
+
+								if(m->phy)
 								{
-									fb_phy = m->phy;
+									if(m->phy < fb_phy)
+									{
+										fb_phy = m->phy;
+									}
 								}
-							}
 
-							dbg_printf("Mode 0x%X = (%ld x %ld x %ld) = phy:%lX\n",
-								m->mode_id, m->width, m->height, m->bpp, m->phy);
+								dbg_printf("Mode 0x%X = (%ld x %ld x %ld) = phy:%lX\n",
+									m->mode_id, m->width, m->height, m->bpp, m->phy);
+							}
 						}
-					}
-				} // for
+					} // for
+				}
 
 				if(vesa_modes_cnt == 0)
 				{
@@ -288,6 +742,8 @@ BOOL VESA_init_hw()
 			 		return FALSE;
 			 	}
 
+				VESA_modes_index();
+
 				vesa_version = info->VESAVersion;
 				vesa_caps = info->Capabilities;
 
@@ -298,6 +754,12 @@ BOOL VESA_init_hw()
 					hda->vram_size = conf_vram_limit*1024*1024;
 				}
 
+				/* tested size from previous boot */
+				if(vesa_modes_cached && cached_vram >= 1*1024*1024 && cached_vram < hda->vram_size)
+				{
+					hda->vram_size = cached_vram;
+				}
+
 				hda->vram_bar_size = hda->vram_size;
 
 				if(fb_phy == 0xFFFFFFFF)
@@ -305,37 +767,58 @@ BOOL VESA_init_hw()
 					fb_phy = ISA_LFB;
 				}
 
-				hda->vram_pm32 = (void*)_MapPhysToLinear(fb_phy, hda->vram_size, 0);
-
-				if(conf_mtrr)
+				lfb_phy = fb_phy;
+				hda->vram_pm32 = NULL;
+				if(conf_ram_shadow && fb_phy > 1*1024*1024)
 				{
-					if(fb_phy > 1*1024*1024)
+					DWORD pages = RoundToPages(hda->vram_size);
+					DWORD lin = _PageReserve(PR_SYSTEM, pages, PR_FIXED);
+
+					if(lin != 0 && lin != 0xFFFFFFFFUL)
 					{
-						if(MTRR_GetVersion())
+						if(_PageCommitPhys(lin >> 12, pages, fb_phy >> 12, PC_INCR | PC_WRITEABLE | PC_USER))
 						{
-							dbg_printf("MTRR supported\n");
-							MTRR_SetPhysicalCacheTypeRange(fb_phy, 0, hda->vram_size, MTRR_FRAMEBUFFERCACHED);
+							hda->vram_pm32 = (void*)lin;
+							lfb_reserved = TRUE;
 						}
 						else
 						{
-							dbg_printf("MTRR unsupported\n");
+							_PageFree((PVOID)lin, 0);
 						}
 					}
 				}
 
-				hda->flags |= FB_SUPPORT_FLIPING | FB_VESA_MODES;
+				if(hda->vram_pm32 == NULL)
+				{
+					hda->vram_pm32 = (void*)_MapPhysToLinear(fb_phy, hda->vram_size, 0);
+				}
+
+				if(conf_mtrr)
+				{
+					FBHDA_write_combine(fb_phy, hda->vram_size);
+				}
+
+				hda->flags |= FB_SUPPORT_FLIPING | FB_SUPPORT_TRIPLE | FB_VESA_MODES;
 
 				vesa_pal = (vesa_palette_entry_t*)(((BYTE*)vesa_buf)+PAL_OFFSET);
 
 				vesa_valid  = TRUE;
 
-				//VESA_load_vbios_pm();
+				if(conf_pm_interface)
+				{
+					VESA_load_vbios_pm();
+				}
 				
-				if(!conf_no_memtest)
+				if(!conf_no_memtest && !(vesa_modes_cached && cached_vram >= 1*1024*1024))
 				{
 					FBHDA_memtest();
 				}
 
+				if(conf_mode_cache && !vesa_modes_cached)
+				{
+					VESA_cache_save(&cache_fp, lfb_phy, hda->vram_size);
+				}
+
 				dbg_printf("VESA_init_hw(vram_size=%ld) = TRUE\n", hda->vram_size);
 				
 				return TRUE;
@@ -352,33 +835,182 @@ BOOL VESA_valid()
 
 BOOL VESA_validmode(DWORD w, DWORD h, DWORD bpp)
 {
-	DWORD i;
+	int i = VESA_mode_find(w, h, bpp);
 
-	for(i = 0; i < vesa_modes_cnt; i++)
+	if(i < 0)
 	{
-		if(vesa_modes[i].width == w && vesa_modes[i].height == h && vesa_modes[i].bpp == bpp)
+		//dbg_printf("fail to valid mode: %ld %ld %ld\n", w, h, bpp);
+		return FALSE;
+	}
+
+	/* same modes follows, one of them must be usable */
+	for(; (DWORD)i < vesa_modes_cnt && VESA_mode_cmp(&vesa_modes[i], w, h, bpp) == 0; i++)
+	{
+		if(vesa_modes[i].flags & VESA_MODE_HW_SUPPORTED)
 		{
 			return TRUE;
 		}
 	}
-	//dbg_printf("fail to valid mode: %ld %ld %ld\n", w, h, bpp);
+
 	return FALSE;
 }
 
+static void VESA_shadow_release()
+{
+	if(shadow_pages)
+	{
+		DWORD page = ((DWORD)hda->vram_pm32 >> 12) + shadow_page;
+
+		_PageDecommit(page, shadow_pages, 0);
+		_PageCommitPhys(page, shadow_pages, (lfb_phy >> 12) + shadow_page, PC_INCR | PC_WRITEABLE | PC_USER);
+
+		shadow_pages = 0;
+	}
+}
+
+/* map back surface to system RAM, system_surface needs to be page aligned */
+static void VESA_shadow_setup()
+{
+	DWORD page;
+	DWORD pages;
+
+	VESA_shadow_release();
+
+	if(!lfb_reserved || screen_mode != SCREEN_EMULATED_COPY)
+	{
+		return;
+	}
+
+	shadow_page = hda->system_surface >> 12;
+	pages = RoundToPages(hda->stride);
+
+	if((shadow_page + pages) * P_SIZE > hda->vram_size)
+	{
+		return;
+	}
+
+	page = ((DWORD)hda->vram_pm32 >> 12) + shadow_page;
+	if(!_PageDecommit(page, pages, 0))
+	{
+		dbg_printf("RAM shadow: _PageDecommit failed\n");
+		return;
+	}
+
+	if(!_PageCommit(page, pages, PD_FIXEDZERO, 0, PC_FIXED | PC_WRITEABLE | PC_USER))
+	{
+		dbg_printf("RAM shadow: _PageCommit failed\n");
+		_PageCommitPhys(page, pages, (lfb_phy >> 12) + shadow_page, PC_INCR | PC_WRITEABLE | PC_USER);
+		return;
+	}
+
+	shadow_pages = pages;
+	dbg_printf("RAM shadow: %ld pages at offset 0x%lX\n", pages, hda->system_surface);
+}
+
+/* front buffer was written outside VESA_copy_tiles */
+static void VESA_tiles_invalidate()
+{
+	tile_front_valid = FALSE;
+}
+
+static void VESA_tiles_setup()
+{
+	DWORD pages;
+
+	VESA_tiles_invalidate();
+
+	/* with RAM shadow reading is cheap, so compare tiles always */
+	if(screen_mode != SCREEN_EMULATED_COPY || !(conf_tile_compare || shadow_pages))
+	{
+		tiles_x = 0;
+		tiles_y = 0;
+		return;
+	}
+
+	tiles_x = (hda->width  + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = (hda->height + TILE_SIZE - 1) / TILE_SIZE;
+	pages = RoundToPages(hda->pitch * hda->height);
+
+	if(pages > tile_front_pages)
+	{
+		if(tile_front)
+		{
+			_PageFree(tile_front, 0);
+		}
+
+		tile_front = (BYTE*)_PageAllocate(pages, PG_SYS, 0, 0, 0x0, 0x100000, NULL, PAGEFIXED);
+		tile_front_pages = tile_front ? pages : 0;
+	}
+
+	if(!tile_front)
+	{
+		tiles_x = 0;
+		tiles_y = 0;
+	}
+
+	dbg_printf("tiles: %ld x %ld\n", tiles_x, tiles_y);
+}
+
 void VESA_clear()
 {
-	memset((BYTE*)hda->vram_pm32+hda->system_surface, 0, hda->pitch*hda->height);
+	fb_memset((BYTE*)hda->vram_pm32+hda->system_surface, 0, hda->pitch*hda->height);
+	VESA_tiles_invalidate();
+}
+
+static void VESA_async_flip_setup(vesa_mode_t *mode)
+{
+	CRS_32 regs;
+
+	if(vesa_version >= VESA_VBE_3_0 && (mode->flags & VESA_MODE_TRIPLE_BUFFERING) != 0)
+	{
+		/* schedule takes address in bytes */
+		load_client_state(&regs);
+		regs.Client_EAX = VESA_CMD_DISPLAY_START;
+		regs.Client_EBX = VESA_DISPLAYSTART_SCHEDULE_ALT;
+		regs.Client_ECX = 0;
+		vesa_bios(&regs);
+		if(VESA_SUCC(regs))
+		{
+			flip_async = FLIP_ASYNC_SCHEDULE;
+		}
+	}
+
+	if(flip_async == FLIP_ASYNC_NONE && (vesa_caps & VESA_CAP_NONVGA) == 0)
+	{
+		flip_async = FLIP_ASYNC_VGA;
+	}
+
+	dbg_printf("async flip: %ld\n", flip_async);
 }
 
 BOOL VESA_setmode_phy(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 {
 	DWORD i;
+	int first = VESA_mode_find(w, h, bpp);
 
-	for(i = 0; i < vesa_modes_cnt; i++)
+	if(first < 0)
+	{
+		dbg_printf("fail to set %ld %ld %ld\n", w, h, bpp);
+		return FALSE;
+	}
+
+	for(i = first; i < vesa_modes_cnt; i++)
 	{
 		if(vesa_modes[i].width == w && vesa_modes[i].height == h && vesa_modes[i].bpp == bpp)
 		{
 			CRS_32 regs;
+
+			if(vesa_modes_cached && !VESA_cache_check(&vesa_modes[i]))
+			{
+				/* BIOS changed, list will be rebuilt on next boot */
+				VESA_cache_drop();
+				if((vesa_modes[i].flags & VESA_MODE_HW_SUPPORTED) == 0)
+				{
+					VESA_modes_index();
+					continue;
+				}
+			}
+
 			VESA_HIRES_enable();
 
 			load_client_state(&regs);
@@ -427,6 +1059,8 @@ BOOL VESA_setmode_phy(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 					}
 				}
 				screen_mode = SCREEN_EMULATED_COPY;
+				flip_async = FLIP_ASYNC_NONE;
+				flip_pending = FALSE;
 
 				if(conf_hw_double_buf > 0)
 				{
@@ -477,7 +1111,11 @@ BOOL VESA_setmode_phy(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 				if(screen_mode <= SCREEN_EMULATED_COPY)
 				{
 					hda->system_surface = hda->stride;
-					hda->surface = hda->stride;
+					if(lfb_reserved && screen_mode == SCREEN_EMULATED_COPY)
+					{
+						hda->system_surface = RoundToPages(hda->stride) * P_SIZE;
+					}
+					hda->surface = hda->system_surface;
 					//hda->system_surface = 0;
 					//hda->flags &= ~FB_SUPPORT_VSYNC;
 				}
@@ -487,11 +1125,18 @@ BOOL VESA_setmode_phy(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 					if(screen_mode == SCREEN_FLIP_VSYNC)
 					{
 						hda->flags |= FB_SUPPORT_VSYNC;
+						if(conf_async_flip)
+						{
+							VESA_async_flip_setup(&vesa_modes[i]);
+						}
 					}
 				}
 
 				FBHDA_update_heap_size(FALSE, vram_heap_in_ram);
 
+				VESA_shadow_setup();
+				VESA_tiles_setup();
+
 				act_mode = i;
 
 				dbg_printf("mode set, mode_id=%d, screen_mode=%d\n", i, screen_mode);
@@ -500,8 +1145,16 @@ BOOL VESA_setmode_phy(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 			else
 			{
 				dbg_printf("vbios fail: eax=0x%lX\n", regs.Client_EAX);
+				if(vesa_modes_cached)
+				{
+					VESA_cache_drop();
+				}
 			}
 		}
+		else
+		{
+			break; /* sorted, no more candidates */
+		}
 	} // for
 
 	dbg_printf("fail to set %ld %ld %ld\n", w, h, bpp);
@@ -514,11 +1167,36 @@ BOOL VESA_setmode(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max)
 	{
 		VESA_clear();
 		mouse_invalidate();
+		FBHDA_vblank_measure();
 		return TRUE;
 	}
 	return FALSE;
 }
 
+/* upload vesa_pal[start..start+count) to RAMDAC by BIOS */
+static void vesa_palette_commit(DWORD start, DWORD count)
+{
+	if(vesa_pm_palette)
+	{
+		vesa_pm_call(vesa_pm_palette, VESA_CMD_PALETTE_DATA, VESA_RAMDAC_DATA_SET,
+			count, start, (DWORD)&vesa_pal[start]);
+	}
+	else
+	{
+		CRS_32 regs;
+		DWORD v86_ptr = vesa_buf_v86+PAL_OFFSET+4*start;
+
+		load_client_state(&regs);
+		regs.Client_EAX = VESA_CMD_PALETTE_DATA;
+		regs.Client_EBX = VESA_RAMDAC_DATA_SET;
+		regs.Client_ECX = count;
+		regs.Client_EDX = start;
+		regs.Client_ES  = V86_SEG(v86_ptr);
+		regs.Client_EDI = V86_OFF(v86_ptr);
+		vesa_bios(&regs);
+	}
+}
+
 void FBHDA_palette_set(unsigned char index, DWORD rgb)
 {
 //	dbg_printf("PAL: %d:0x%lX,bpp:%d\n", index, rgb, vesa_pal_bits);
@@ -542,9 +1220,6 @@ void FBHDA_palette_set(unsigned char index, DWORD rgb)
 	}
 	else
 	{
-		CRS_32 regs;
-		DWORD v86_ptr = vesa_buf_v86+PAL_OFFSET+4*index;
-
 		if(vesa_pal_bits == 8)
 		{
 			vesa_pal[index].Red     = (rgb >> 16) & 0xFF;
@@ -558,15 +1233,50 @@ void FBHDA_palette_set(unsigned char index, DWORD rgb)
 			vesa_pal[index].Blue    = (rgb >>  2) & 0x3F;
 		}
 
-		load_client_state(&regs);
-		regs.Client_EAX = VESA_CMD_PALETTE_DATA;
-		regs.Client_EBX = VESA_RAMDAC_DATA_SET;
-		regs.Client_ECX = 1;
-		regs.Client_EDX = index;
-		regs.Client_ES  = V86_SEG(v86_ptr);
-		regs.Client_EDI = V86_OFF(v86_ptr);
-		vesa_bios(&regs);
+		vesa_palette_commit(index, 1);
+	}
+}
+
+void FBHDA_palette_set_range(DWORD start, DWORD count, DWORD *colors)
+{
+	DWORD i;
+
+	if(start >= 256)
+		return;
+
+	if(start + count > 256)
+		count = 256 - start;
+
+	if(count == 0)
+		return;
+
+	if((vesa_caps & VESA_CAP_NONVGA) == 0)
+	{
+		const int shift = (vesa_pal_bits == 8) ? 0 : 2;
+
+		outp(VGA_DAC_W_INDEX, start);    /* index is auto-incremented */
+		for(i = 0; i < count; i++)
+		{
+			outp(VGA_DAC_DATA, ((colors[i] >> 16) & 0xFF) >> shift);
+			outp(VGA_DAC_DATA, ((colors[i] >>  8) & 0xFF) >> shift);
+			outp(VGA_DAC_DATA,  (colors[i]        & 0xFF) >> shift);
+		}
+	}
+	else
+	{
+		const int shift = (vesa_pal_bits == 8) ? 0 : 2;
+
+		for(i = 0; i < count; i++)
+		{
+			vesa_pal[start + i].Red     = ((colors[i] >> 16) & 0xFF) >> shift;
+			vesa_pal[start + i].Green   = ((colors[i] >>  8) & 0xFF) >> shift;
+			vesa_pal[start + i].Blue    =  (colors[i]        & 0xFF) >> shift;
+		}
+
+		/* one BIOS call for whole range */
+		vesa_palette_commit(start, count);
 	}
+	hda->palette_update++;
 }
 
 DWORD FBHDA_palette_get(unsigned char index)
@@ -611,7 +1321,93 @@ DWORD FBHDA_palette_get(unsigned char index)
 
 #define SWAP_TESTS 1024
 
-BOOL FBHDA_swap(DWORD offset)
+/* check if last async flip is already on screen */
+static BOOL flip_done()
+{
+	if(!flip_pending)
+	{
+		return TRUE;
+	}
+
+	if((vesa_caps & VESA_CAP_NONVGA) == 0)
+	{
+		/* start address is latched at begin of retrace, so wait for active->retrace edge */
+		if((inp(VGA_STAT_ADDR) & VGA_STAT_VSYNC) == 0)
+		{
+			flip_seen_active = TRUE;
+		}
+		else if(flip_seen_active)
+		{
+			flip_pending = FALSE;
+			return TRUE;
+		}
+	}
+
+	/* port status can be missed between checks */
+	if(Get_System_Time() - flip_time >= FLIP_TIMEOUT_MS)
+	{
+		flip_pending = FALSE;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void flip_async_set(DWORD offset)
+{
+	if(flip_async == FLIP_ASYNC_VGA && vesa_pm_display_start)
+	{
+		vesa_pm_set_start(offset, FALSE);
+	}
+	else
+	{
+		CRS_32 regs;
+		load_client_state(&regs);
+
+		regs.Client_EAX = VESA_CMD_DISPLAY_START;
+		if(flip_async == FLIP_ASYNC_SCHEDULE)
+		{
+			regs.Client_EBX = VESA_DISPLAYSTART_SCHEDULE_ALT;
+			regs.Client_ECX = offset;
+		}
+		else
+		{
+			DWORD off_x, off_y;
+			offset_calc(offset, &off_x, &off_y);
+			regs.Client_EBX = VESA_DISPLAYSTART_SET;
+			regs.Client_ECX = off_x;
+			regs.Client_EDX = off_y;
+		}
+		vesa_bios(&regs);
+	}
+
+	flip_pending = TRUE;
+	flip_time = Get_System_Time();
+	flip_seen_active = FALSE;
+	if((vesa_caps & VESA_CAP_NONVGA) == 0)
+	{
+		flip_seen_active = (inp(VGA_STAT_ADDR) & VGA_STAT_VSYNC) == 0;
+	}
+}
+
+BOOL FBHDA_swap_ready()
+{
+	if(flip_async != FLIP_ASYNC_NONE && screen_mode == SCREEN_FLIP_VSYNC)
+	{
+		return flip_done();
+	}
+
+	if(screen_mode == SCREEN_FLIP_VSYNC && (vesa_caps & VESA_CAP_NONVGA) == 0)
+	{
+		/* flip in vertical retrace, so BIOS don't need to wait for it */
+		return (inp(VGA_STAT_ADDR) & VGA_STAT_VSYNC) != 0;
+	}
+
+	return TRUE;
+}
+
+/* async = TRUE: don't wait for flip, used only for queued flips */
+static BOOL VESA_swap(DWORD offset, BOOL async)
 {
 	if((offset + hda->stride) < hda->vram_size && offset >= hda->system_surface)
 	{
@@ -633,6 +1429,28 @@ BOOL FBHDA_swap(DWORD offset)
 				{
 					mouse_erase();
 				}
+				if(async && screen_mode == SCREEN_FLIP_VSYNC && flip_async != FLIP_ASYNC_NONE)
+				{
+					/* fire and forget, completion is checked by FBHDA_swap_ready */
+					flip_async_set(offset);
+					hda->surface = offset;
+					if(fb_lock_cnt == 0)
+					{
+						mouse_blit();
+					}
+					break;
+				}
+				if(vesa_pm_display_start)
+				{
+					/* direct call, BIOS waits for retrace itself */
+					vesa_pm_set_start(offset, screen_mode == SCREEN_FLIP_VSYNC);
+					hda->surface = offset;
+					if(fb_lock_cnt == 0)
+					{
+						mouse_blit();
+					}
+					break;
+				}
 				offset_calc(offset, &off_x, &off_y);
 				load_client_state(&regs);
 
@@ -675,58 +1493,51 @@ BOOL FBHDA_swap(DWORD offset)
 				break;
 			}
 		}
+		FBHDA_present_mark();
 		return TRUE;
 	}
 	return FALSE;
 }
 
-static inline void update_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
+BOOL FBHDA_swap(DWORD offset)
+{
+	return VESA_swap(offset, FALSE);
+}
+
+BOOL FBHDA_swap_queued(DWORD offset)
 {
-	if(left < rect_left)
-		rect_left = left;
+	return VESA_swap(offset, TRUE);
+}
 
-	if(top < rect_top)
-		rect_top = top;
+static inline void update_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
+{
+	if(right > hda->width)
+		right = hda->width;
 
-	if(right > rect_right)
-		rect_right = right;
+	if(bottom > hda->height)
+		bottom = hda->height;
 
-	if(bottom > rect_bottom)
-		rect_bottom = bottom;
+	dirty_add(&dirty, left, top, right, bottom);
 }
 
 void FBHDA_access_begin(DWORD flags)
 {
+	DWORD l, t, r, b;
+
 	//Wait_Semaphore(hda_sem, 0);
 	if(fb_lock_cnt++ == 0)
 	{
-		if(flags & FBHDA_ACCESS_MOUSE_MOVE)
-		{
-			if(!mouse_get_rect(&rect_left, &rect_top, &rect_right, &rect_bottom))
-			{
-				rect_left   = 0;
-				rect_top    = 0;
-				rect_right  = 0;
-				rect_bottom = 0;
-			}
-		}
-		else
+		dirty_reset(&dirty);
+		if((flags & FBHDA_ACCESS_MOUSE_MOVE) == 0)
 		{
-			rect_left   = 0;
-			rect_top    = 0;
-			rect_right  = hda->width;
-			rect_bottom = hda->height;
+			update_rect(0, 0, hda->width, hda->height);
 		}
 		mouse_erase();
 	}
-	else
-	{
-		DWORD l, t, r, b;
 
-		if(mouse_get_rect(&l, &t, &r, &b))
-		{
-			update_rect(l, t, r, b);
-		}
+	if(mouse_get_rect(&l, &t, &r, &b))
+	{
+		update_rect(l, t, r, b);
 	}
 }
 
@@ -735,38 +1546,91 @@ void FBHDA_access_rect(DWORD left, DWORD top, DWORD right, DWORD bottom)
 	if(fb_lock_cnt++ == 0)
 	{
 		mouse_erase();
-		rect_left   = left;
-		rect_top    = top;
-		rect_right  = right;
-		rect_bottom = bottom;
+		dirty_reset(&dirty);
 	}
-	else
+
+	update_rect(left, top, right, bottom);
+}
+
+static void VESA_copy_rect(dirty_rect_t *r)
+{
+	DWORD y;
+	DWORD bs = (hda->bpp + 7) >> 3;
+	DWORD line_size = (r->right - r->left) * bs;
+	DWORD line_start = r->left * bs;
+	BYTE *dst = (BYTE*)hda->vram_pm32;
+	BYTE *src = ((BYTE*)hda->vram_pm32) + hda->surface;
+
+	dst += (r->top * hda->pitch) + line_start;
+	src += (r->top * hda->pitch) + line_start;
+
+	for(y = r->top; y < r->bottom; y++)
 	{
-		update_rect(left, top, right, bottom);
+		fb_memcpy(dst, src, line_size);
+		dst += hda->pitch;
+		src += hda->pitch;
 	}
 }
 
-static void VESA_copy_rect()
+/* compare tile with front copy and update the copy, returns TRUE if differs */
+static BOOL tile_update(BYTE *src, BYTE *front, DWORD pitch, DWORD line_size, DWORD lines)
 {
-	if((rect_right > rect_left) && (rect_bottom > rect_top))
+	DWORD y;
+	BOOL changed = FALSE;
+
+	for(y = 0; y < lines; y++)
 	{
-		DWORD y;
-		DWORD bs = (hda->bpp + 7) >> 3;
-		DWORD line_size = (rect_right - rect_left) * bs;
-		DWORD line_start = rect_left * bs;
-		BYTE *dst = (BYTE*)hda->vram_pm32;
-		BYTE *src = ((BYTE*)hda->vram_pm32) + hda->surface;
+		if(changed || memcmp(front, src, line_size) != 0)
+		{
+			memcpy(front, src, line_size);
+			changed = TRUE;
+		}
+		src += pitch;
+		front += pitch;
+	}
 
-		dst += (rect_top * hda->pitch) + line_start;
-		src += (rect_top * hda->pitch) + line_start;
+	return changed;
+}
 
-		for(y = rect_top; y < rect_bottom; y++)
+/* copy only tiles from rect which content changed, returns number of copied pixels */
+static DWORD VESA_copy_tiles(dirty_rect_t *r)
+{
+	DWORD bs = (hda->bpp + 7) >> 3;
+	BYTE *src = ((BYTE*)hda->vram_pm32) + hda->surface;
+	DWORD tx_end = (r->right  + TILE_SIZE - 1) / TILE_SIZE;
+	DWORD ty_end = (r->bottom + TILE_SIZE - 1) / TILE_SIZE;
+	DWORD tx, ty;
+	DWORD copied = 0;
+
+	for(ty = r->top / TILE_SIZE; ty < ty_end; ty++)
+	{
+		for(tx = r->left / TILE_SIZE; tx < tx_end; tx++)
 		{
-			memcpy(dst, src, line_size);
-			dst += hda->pitch;
-			src += hda->pitch;
+			dirty_rect_t t;
+			DWORD off;
+
+			t.left   = tx * TILE_SIZE;
+			t.top    = ty * TILE_SIZE;
+			t.right  = t.left + TILE_SIZE;
+			t.bottom = t.top  + TILE_SIZE;
+
+			if(t.right > hda->width)
+				t.right = hda->width;
+
+			if(t.bottom > hda->height)
+				t.bottom = hda->height;
+
+			off = (t.top * hda->pitch) + (t.left * bs);
+			if(tile_update(src + off, tile_front + off, hda->pitch,
+				(t.right - t.left) * bs, t.bottom - t.top))
+			{
+				VESA_copy_rect(&t);
+				copied += dirty_area(&t);
+			}
 		}
 	}
+
+	return copied;
 }
 
 void FBHDA_access_end(DWORD flags)
@@ -792,32 +1656,50 @@ void FBHDA_access_end(DWORD flags)
 			case SCREEN_EMULATED_CENTER:
 			case SCREEN_EMULATED_COPY:
 			{
-				if(rect_left > hda->width)
-					rect_left = 0;
-
-				if(rect_top > hda->height)
-					rect_top = 0;
+				DWORD i;
 
-				if(rect_right > hda->width)
-					rect_right = hda->width;
+				if(screen_mode == SCREEN_EMULATED_COPY && tiles_x > 0)
+				{
+					if(!tile_front_valid)
+					{
+						/* screen content is unknown, copy everything and refill the front copy */
+						dirty_reset(&dirty);
+						update_rect(0, 0, hda->width, hda->height);
+						hda->dirty_damaged += dirty.damage;
+						fb_memcpy(tile_front, ((BYTE*)hda->vram_pm32)+hda->surface, hda->pitch*hda->height);
+						fb_memcpy(hda->vram_pm32, tile_front, hda->pitch*hda->height);
+						hda->dirty_blitted += dirty_pixels(&dirty);
+						tile_front_valid = TRUE;
+						break;
+					}
 
-				if(rect_bottom > hda->height)
-					rect_bottom = hda->height;
+					hda->dirty_damaged += dirty.damage;
+					for(i = 0; i < dirty.cnt; i++)
+					{
+						hda->dirty_blitted += VESA_copy_tiles(&dirty.rects[i]);
+					}
+					break;
+				}
 
-				if(rect_left == 0 && rect_top == 0 &&
-					rect_right == hda->width && rect_bottom == hda->height)
+				if(dirty.cnt == 1 && dirty_area(&dirty.rects[0]) == hda->width * hda->height)
 				{
-					memcpy(hda->vram_pm32, ((BYTE*)hda->vram_pm32)+hda->surface, hda->stride);
+					fb_memcpy(hda->vram_pm32, ((BYTE*)hda->vram_pm32)+hda->surface, hda->stride);
 				}
 				else
 				{
-					VESA_copy_rect();
+					for(i = 0; i < dirty.cnt; i++)
+					{
+						VESA_copy_rect(&dirty.rects[i]);
+					}
 				}
 
+				hda->dirty_damaged += dirty.damage;
+				hda->dirty_blitted += dirty_pixels(&dirty);
 				break;
 			}
 		}
 		// cursor
+		FBHDA_swap_flush(FALSE);
 	}
 
 	//Signal_Semaphore(hda_sem);
@@ -844,6 +1726,8 @@ void VESA_HIRES_enable()
 {
 	dbg_printf("VESA_HIRES_enable\n");
 	vga_mode = FALSE;
+	/* screen could be overwritten by full screen DOS */
+	VESA_tiles_invalidate();
 }
 
 void VESA_HIRES_disable()